@@ -1,134 +1,433 @@
+#include "asm.h"
 #include "opcode.h"
 #include "ltokenizer.h"
+#include "diagnostics.h"
+#include "compress.h"
+#include "symfile.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <map>
 #include <regex>
+#include <string>
+#include <vector>
 
 using namespace std;
 
 /** assembler variables **/
 int pass = 1;
-uint16_t offset = 0;
-bool success = true, allowIllegalOpcodes = false;
+uint32_t offset = 0;        // wider than an address so running off the end of memory can be caught
+uint16_t origin = 0;
+bool allowIllegalOpcodes = false;
 size_t lineNo = 1;
+size_t programLine = 0;     // index in the program of the line being assembled
+const string *currentFile = nullptr;
 map<string,uint16_t> symtable;
+// an anonymous label, found by the line it is defined on
+struct AnonymousLabel {
+    size_t line;
+    uint16_t address;
+};
+
+vector<AnonymousLabel> forwardLabels, backwardLabels;     // anonymous + and - labels, in program order
+bool labelsFinished = false;
+LabelScope labelScope = { "", 0 };
+bool compressOutput = false, selfExtracting = false;
+uint16_t stubAddress = 0;
+MemoryImage programImage;
 ofstream of;
+bool writeThrough = false, fileStarted = false;
+uint16_t fileLoadAddress = 0;       // of the bytes written through so far
 
-void error(string msg) {
+void error(string msg, size_t column = 0) {
     // supress errors on first pass
     if (pass == 1) return;
-    
-    cerr << "Error (line " << dec << lineNo << "): " << msg << endl;
-    success = false;
+
+    reportDiagnostic(SeverityError, *currentFile, lineNo, column, msg);
 }
 
-void warning(string msg) {
+void warning(string msg, size_t column = 0) {
     // supress warnings on first pass
     if (pass == 1) return;
 
-    cout << "Warning (line " << dec << lineNo << "): " << msg << endl;
+    reportDiagnostic(SeverityWarning, *currentFile, lineNo, column, msg);
 }
 
-void writeInstruction(InstructionPacket ip) {
-    if (of.is_open()) {
-        of.put(ip.opcode);
-        if (ip.size > 1) of.put((uint8_t) (ip.argument & ~0xff00));
-        if (ip.size > 2) of.put((uint8_t) (ip.argument >> 8));
+int encodeInstruction(InstructionPacket ip, uint8_t *out) {
+    out[0] = ip.opcode;
+    if (ip.size > 1) out[1] = (uint8_t) (ip.argument & ~0xff00);
+    if (ip.size > 2) out[2] = (uint8_t) (ip.argument >> 8);
+    return ip.size;
+}
+
+/**
+ * put bytes that just went into the image in their place in the output file, once the file's
+ * load address is known. a PRG cannot grow downwards, so bytes below it leave it to close()
+ */
+void writeOut(uint16_t address, const uint8_t *bytes, size_t size) {
+    if (!writeThrough || compressOutput || size == 0) return;
+
+    if (!fileStarted) {
+        fileStarted = true;
+        fileLoadAddress = address;
+        of.put((uint8_t) (address &~ 0xff00));
+        of.put((uint8_t) (address >> 8));
+    }
+
+    if (address < fileLoadAddress) {
+        writeThrough = false;
+        return;
     }
+
+    // seeking past the end leaves zeros in the gap, as close() would
+    of.seekp(2 + (address - fileLoadAddress));
+    of.write((const char *) bytes, size);
+}
+
+// see API note in asm.h
+string emitBytes(uint32_t address, const uint8_t *bytes, size_t size, ByteOwner owner) {
+    if (address + size > MemoryImage::SIZE) return "Code runs past the end of the address space";
+
+    ByteOwner previous;
+    bool clean = programImage.write((uint16_t) address, bytes, size, owner, previous);
+    writeOut((uint16_t) address, bytes, size);
+    if (!clean) return "Overlaps code emitted by " + *previous.file + ":" + to_string(previous.line);
+
+    return "";
+}
+
+// see API note in asm.h
+void patchBytes(uint16_t address, const uint8_t *bytes, size_t size) {
+    programImage.store(address, bytes, size);
+    writeOut(address, bytes, size);
+}
+
+MemoryImage& getProgramImage() { return programImage; }
+
+const map<string, uint16_t>& getSymbolTable() { return symtable; }
+
+void writeInstruction(InstructionPacket ip) {
+    uint8_t bytes[3];
+    string msg = emitBytes(offset, bytes, encodeInstruction(ip, bytes), { currentFile, lineNo });
+    if (!msg.empty()) error(msg);
 }
 
 void printInstruction(InstructionPacket ip) {
-    cout << "Opcode: $" << hex << setw(2) << (int) ip.opcode 
+    cout << "Opcode: $" << hex << setw(2) << (int) ip.opcode
     << ", operand: $" << setw(4) << setfill('0') << ip.argument
     << ", size: " << setw(0) << setfill(' ') << ip.size
     << ", label: " << ip.label << endl;
 }
 
-const char *labelRegex = "^([0-9a-zA-Z_]*):?$";
+const regex labelRegex("^(@?[0-9a-zA-Z_]*|\\+|-):?$");
 bool matchesLabel(string token) {
-    return (regex_match(token, regex(labelRegex)));
+    return (regex_match(token, labelRegex));
 }
 
 string stripLabel(string label) {
-    regex re = regex(labelRegex);
     smatch match;
 
-    if (regex_search(label, match, re) == true) return match.str(1);
+    if (regex_search(label, match, labelRegex) == true) return match.str(1);
     return label;
 }
 
-uint16_t getSymbolArgument(string label, bool relative) {
-    cout << "looking for label " << label << endl;
-    if (symtable.find(label) == symtable.end()) {
-        error("Unknown label or mnemonic");
-    } else {
-        uint16_t address = symtable[label];
-        if (relative) {
-            int value = ((int) address) - ((int) offset);
-            if (value < -128 || value > 127) {
-                error("Relative jump out of range");
-            }
-
-            return (uint16_t) ((uint8_t) value);
+/**
+ * .db $xx[,$xx...] - emit literal data bytes
+ */
+void doDataBytes(LineTokenizer& lt, LineRecord& rec) {
+    static const regex byteRegex("^\\$([0-9a-f]{1,2})$");
+    size_t column = lt.lastColumn();
+
+    // spaces after the commas split the list over several tokens, glue it back together
+    string list, token;
+    while (!(token = lt.nextToken()).empty()) list += token;
+
+    if (list.empty()) {
+        rec.error = "Missing operand";
+        rec.errorColumn = column;
+        return;
+    }
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos) end = list.size();
+
+        smatch match;
+        string item = list.substr(start, end - start);
+        if (!regex_match(item, match, byteRegex)) {
+            rec.error = "Illegal data byte";
+            rec.errorColumn = column;
+            rec.data.clear();
+            return;
         }
 
-        return address;
+        rec.data.push_back((uint8_t) stoi(match.str(1), 0, 16));
+        start = end + 1;
+    }
+}
+
+/**
+ * .org $xxxx - continue assembling at a new address
+ */
+void doOrigin(LineTokenizer& lt, LineRecord& rec) {
+    static const regex addressRegex("^\\$([0-9a-f]{1,4})$");
+    size_t column = lt.lastColumn();
+
+    string argument = lt.nextToken();
+    smatch match;
+    if (!regex_match(argument, match, addressRegex)) {
+        rec.error = argument.empty() ? "Missing operand" : "Illegal address";
+        rec.errorColumn = argument.empty() ? column : lt.lastColumn();
+        return;
+    }
+
+    rec.setsOrigin = true;
+    rec.newOrigin = (uint16_t) stoi(match.str(1), 0, 16);
+}
+
+/**
+ * .local - start a new scope for @labels without defining a global label
+ */
+void doLocal(LineTokenizer&, LineRecord& rec) {
+    rec.opensScope = true;
+}
+
+/**
+ * .var, .zp and .ram are taken out of the program by allocateVariables() before assembly starts,
+ * which needs the whole program up front. It only looks for declarations without a label
+ */
+void doVariableDeclaration(LineTokenizer& lt, LineRecord& rec) {
+    if (!rec.label.empty()) {
+        rec.error = "Declarations cannot have a label";
+        rec.errorColumn = lt.lastColumn();
+        return;
     }
+    rec.error = "Variables cannot be used when streaming";
+}
+
+using directiveMethod = void (*)(LineTokenizer& lt, LineRecord& rec);
+
+static const map<string, directiveMethod> directives = {
+    { ".db", doDataBytes },
+    { ".local", doLocal },
+    { ".org", doOrigin },
+    { ".ram", doVariableDeclaration },
+    { ".var", doVariableDeclaration },
+    { ".zp", doVariableDeclaration }
+};
 
-    return 0;
+bool matchesDirective(string token) {
+    return (directives.find(token) != directives.end());
 }
 
-void doOpcode(string mnemonic, LineTokenizer lt) {
+// see API note in asm.h
+LineRecord classifyLine(string line) {
+    LineRecord rec;
+
+    // blank and comment lines need no tokenizing, repeated instructions come from the line cache
+    LineKey key = normalizeLine(line);
+    if (key.text.empty()) return rec;
+    if (findCachedLine(key, rec.ip)) {
+        rec.hasInstruction = true;
+        return rec;
+    }
+
+    LineTokenizer lt(line);
+
     string token = lt.nextToken();
+    if (!token.empty() && !matchesOpcode(token) && !matchesDirective(token)) {
+        if (!matchesLabel(token)) {
+            rec.error = "Illegal identifier";
+            rec.errorColumn = lt.lastColumn();
+            return rec;
+        }
+
+        rec.label = stripLabel(token);
+        token = lt.nextToken();
+    }
 
-    InstructionPacket ip = buildInstruction(mnemonic, token);
-    if (ip == IllegalInstruction) {
-        error("Illegal combination of opcode and operands");
+    // blank, comment-only and label-only lines are finished here
+    if (token.empty()) return rec;
+
+    auto directive = directives.find(token);
+    if (directive != directives.end()) {
+        directive->second(lt, rec);
+        return rec;
+    }
+
+    if (!matchesOpcode(token)) {
+        rec.error = "Illegal identifier";
+        rec.errorColumn = lt.lastColumn();
+        return rec;
+    }
+
+    size_t mnemonicColumn = lt.lastColumn();
+    string argument = lt.nextToken();
+    rec.operandColumn = argument.empty() ? mnemonicColumn : lt.lastColumn();
+
+    rec.ip = buildInstruction(token, argument);
+    if (rec.ip == IllegalInstruction) {
+        rec.error = "Illegal combination of opcode and operands";
+        rec.errorColumn = mnemonicColumn;
     } else {
-        if (pass == 2 && ip.isLabelType) {
-            ip.argument = getSymbolArgument(ip.label, ip.isRelativeJump);
-        }
+        rec.hasInstruction = true;
+        if (rec.label.empty() && !rec.ip.isLabelType) cacheLine(key, rec.ip);
+    }
 
-        offset += ip.size;
-        if (pass == 2) {
-            writeInstruction(ip);
-        }
+    return rec;
+}
+
+// see API note in asm.h
+size_t recordSize(const LineRecord& rec) {
+    return rec.hasInstruction ? rec.ip.size : rec.data.size();
+}
+
+static bool isLocalLabel(const string& label) {
+    return (!label.empty() && label[0] == '@');
+}
+
+static bool isAnonymousLabel(const string& label) {
+    return (!label.empty() && (label[0] == '+' || label[0] == '-'));
+}
+
+// see API note in asm.h
+bool needsScope(const LineRecord& rec) {
+    return (rec.opensScope || !rec.label.empty() || (rec.hasInstruction && isLocalLabel(rec.ip.label)));
+}
+
+// see API note in asm.h
+void enterScope(LabelScope& scope, LineRecord& rec) {
+    if (rec.opensScope) scope.name = "." + to_string(++scope.unnamed);
+
+    // a global label on the line opens its scope before the operand is looked at
+    if (isLocalLabel(rec.label)) rec.label = scope.name + rec.label;
+    else if (!rec.label.empty() && !isAnonymousLabel(rec.label)) scope.name = rec.label;
+
+    if (rec.hasInstruction && isLocalLabel(rec.ip.label)) rec.ip.label = scope.name + rec.ip.label;
+}
+
+// see API note in asm.h
+bool defineLabel(string label, uint16_t address, size_t line) {
+    if (isAnonymousLabel(label)) {
+        ((label == "+") ? forwardLabels : backwardLabels).push_back({ line, address });
+        return true;
     }
+
+    bool isNew = (symtable.find(label) == symtable.end());
+    symtable[label] = address;
+    return isNew;
 }
 
-void doLabel(string label, LineTokenizer lt) {
-    if (pass == 1) {
-        label = stripLabel(label);
-        if (symtable.find(label) != symtable.end()) {
-            warning("Label redefinition");
-        }
+// see API note in asm.h
+void finishLabels() {
+    labelsFinished = true;
+}
+
+/**
+ * anonymous references count definitions outwards from the referring line: - is the closest
+ * label on or before it, -- the one before that, + the closest label after it and so on
+ */
+static string findAnonymousLabel(const string& label, size_t line, uint16_t& address) {
+    const vector<AnonymousLabel>& labels = (label[0] == '+') ? forwardLabels : backwardLabels;
+    size_t after = upper_bound(labels.begin(), labels.end(), line,
+                               [](size_t l, const AnonymousLabel& a) { return l < a.line; }) - labels.begin();
+    size_t count = label.size();
 
-        symtable[label] = offset;
+    if (label[0] == '-') {
+        if (count > after) return "No anonymous label in range";
+        address = labels[after - count].address;
+    } else {
+        // more + labels may still be on their way
+        if (after + count > labels.size()) return labelsFinished ? "No anonymous label in range" : "Unknown label or mnemonic";
+        address = labels[after + count - 1].address;
     }
 
-    string token = lt.nextToken();
-    
-    if (matchesOpcode(token)) {
-        doOpcode(token, lt);
-    } else if (!token.empty()) {
-        error("Illegal identifier");
+    return "";
+}
+
+// see API note in asm.h
+string resolveLabel(InstructionPacket& ip, uint16_t pc, size_t line, bool useSnapshots) {
+    uint16_t address;
+    if (isAnonymousLabel(ip.label)) {
+        string msg = findAnonymousLabel(ip.label, line, address);
+        if (!msg.empty()) return msg;
+    } else {
+        // labels defined by the program shadow the ones loaded from snapshots
+        auto it = symtable.find(ip.label);
+        if (it != symtable.end()) address = it->second;
+        else if (!useSnapshots || !findSnapshotSymbol(ip.label, address)) return "Unknown label or mnemonic";
     }
+
+    return setLabelArgument(ip, pc, address);
 }
 
-void assemble(string line) {
-    LineTokenizer lt(line);
+// see API note in asm.h
+string setLabelArgument(InstructionPacket& ip, uint16_t pc, uint16_t address) {
+    if (ip.isRelativeJump) {
+        // branches are taken relative to the address of the following instruction
+        int value = ((int) address) - ((int) pc + ip.size);
+        if (value < -128 || value > 127) return "Relative jump out of range";
 
-    string token = lt.nextToken();
-    if (matchesOpcode(token)) {
-        doOpcode(token, lt);
-    } else if (matchesLabel(token)) {
-        doLabel(token, lt);
+        ip.argument = (uint16_t) ((uint8_t) value);
+    } else {
+        ip.argument = address;
+    }
+
+    return "";
+}
+
+void doOpcode(InstructionPacket ip, size_t operandColumn) {
+    if (pass == 2 && ip.isLabelType) {
+        string msg = resolveLabel(ip, (uint16_t) offset, programLine);
+        if (!msg.empty()) error(msg, operandColumn);
+    }
+
+    if (pass == 2) {
+        writeInstruction(ip);
     }
+    offset += ip.size;
+}
 
-    lineNo++;
+void doData(const vector<uint8_t>& data) {
+    if (pass == 2) {
+        string msg = emitBytes(offset, data.data(), data.size(), { currentFile, lineNo });
+        if (!msg.empty()) error(msg);
+    }
+    offset += data.size();
+}
+
+void doLabel(string label) {
+    // labels are only defined on the first pass, where warning() would swallow the message
+    if (pass == 1) {
+        if (!defineLabel(label, (uint16_t) offset, programLine)) {
+            reportDiagnostic(SeverityWarning, *currentFile, lineNo, 0, "Label redefinition");
+        }
+    }
+}
+
+void assemble(const SourceLine& line) {
+    currentFile = &line.file->path;
+    lineNo = line.line;
+
+    LineRecord rec = classifyLine(string(line.text()));
+    if (needsScope(rec)) enterScope(labelScope, rec);
+
+    // a label on an .org line names the new address
+    if (rec.setsOrigin) offset = rec.newOrigin;
+    if (!rec.label.empty()) doLabel(rec.label);
+
+    if (!rec.error.empty()) {
+        error(rec.error, rec.errorColumn);
+    } else if (rec.hasInstruction) {
+        doOpcode(rec.ip, rec.operandColumn);
+    } else if (!rec.data.empty()) {
+        doData(rec.data);
+    }
+
+    programLine++;
 }
 
 void dumpSymbolTable() {
@@ -142,23 +441,85 @@ void setOutFile(string ofn) {
 }
 
 void startNextPass() {
-    offset = 0;
-    lineNo = 1;
+    if (pass == 1) finishLabels();
+
+    // pass 2 classifies the same lines again, which says nothing about how repetitive the source is
+    countLineCacheLookups(false);
+
+    offset = origin;
+    programLine = 0;
+    labelScope = { "", 0 };
     pass++;
 }
 
+void setWriteThrough(bool on) {
+    writeThrough = on;
+}
+
+void setCompression(bool compress, bool selfExtract, uint16_t address) {
+    compressOutput = compress || selfExtract;
+    selfExtracting = selfExtract;
+    stubAddress = address;
+}
+
+/**
+ * put the unpack stub in front of the packed image. returns an error message if the stub and data
+ * would be overwritten while they unpack
+ */
+string prependUnpackStub(vector<uint8_t>& packed, uint16_t low, size_t size) {
+    vector<uint8_t> stub;
+    string msg = buildUnpackStub(stubAddress, low, origin, stub);
+    if (!msg.empty()) return msg;
+
+    packed.insert(packed.begin(), stub.begin(), stub.end());
+
+    uint32_t loadEnd = stubAddress + packed.size(), unpackEnd = low + size;
+    if (loadEnd > MemoryImage::SIZE) return "Self-extracting program runs past the end of the address space";
+    if (stubAddress < unpackEnd && low < loadEnd) return "Self-extracting stub and packed data overlap the unpacked program";
+    if (low <= 0xfe && unpackEnd > 0xf9) return "Unpacked program overwrites the stub's zero page pointers at $f9-$fe";
+
+    return "";
+}
+
 void close() {
+    // everything is in the file already, unless a segment went below the load address
+    if (writeThrough && fileStarted) {
+        of.flush();
+        of.close();
+        return;
+    }
+    if (fileStarted) of.seekp(0);
+
+    // the PRG file loads at the lowest address that was written and runs to the highest. a PRG
+    // holds a single block, so untouched gaps between segments are written as zeros
+    uint16_t low = programImage.empty() ? origin : programImage.lowest();
+    const uint8_t *bytes = programImage.data() + low;
+    size_t size = programImage.empty() ? 0 : programImage.highest() - low + 1;
+
+    // packed images keep the unpack address in the header, self-extracting ones load at the stub
+    uint16_t loadAddress = low;
+    vector<uint8_t> packed;
+    if (compressOutput) {
+        packed = compressData(bytes, size);
+        if (selfExtracting) {
+            string msg = prependUnpackStub(packed, low, size);
+            if (!msg.empty()) reportDiagnostic(SeverityError, 0, 0, msg);
+            loadAddress = stubAddress;
+        }
+
+        bytes = packed.data();
+        size = packed.size();
+    }
+
+    of.put((uint8_t) (loadAddress &~ 0xff00));
+    of.put((uint8_t) (loadAddress >> 8));
+    of.write((const char *) bytes, size);
+
     of.flush();
     of.close();
 }
 
-bool isSuccessfulAssembly() { return success; }
-void setProgramStart(uint16_t org) { 
-    offset = org;
-
-    // write the origin to the PRG file
-    of.put((uint8_t) (org &~ 0xff00));
-    of.put((uint8_t) (org >> 8));
-
-    offset+=2;      // we wrote two bytes to the file for the start pointer
-}
\ No newline at end of file
+bool isSuccessfulAssembly() { return errorCount() == 0; }
+void setProgramStart(uint16_t org) {
+    offset = origin = org;
+}
@@ -1,20 +1,153 @@
 #ifndef _6502_ASM_H
 #define _6502_ASM_H
 
+#include "opcode.h"
+#include "source.h"
+#include "image.h"
+
 #include <iostream>
 #include <string>
+#include <vector>
 #include <map>
 
 #include <cstdint>
 
-void assemble(std::string line);
+/**
+ * LineRecord: everything that can be learned from a source line on its own - the label it
+ * defines, the instruction it encodes and the size of that instruction. Label arguments are
+ * left unresolved (see resolveLabel())
+ */
+struct LineRecord {
+    std::string label;          // label defined on this line, empty if none
+    InstructionPacket ip = IllegalInstruction;  // the encoded instruction, valid when hasInstruction is set
+    bool hasInstruction = false;
+    std::string error;          // empty if the line classified cleanly
+    size_t errorColumn = 0;     // column of the token the error is about, 0 if unknown
+    size_t operandColumn = 0;   // column of the operand, for errors found when resolving labels
+    std::vector<uint8_t> data;  // bytes emitted by a data directive
+    bool setsOrigin = false;    // .org: assembly continues at newOrigin, before the label is defined
+    uint16_t newOrigin = 0;
+    bool opensScope = false;    // .local: following @labels belong to a new, unnamed scope
+};
+
+/**
+ * LabelScope: the scope @local labels are defined and looked up in. A global label opens a
+ * scope named after itself, .local opens an unnamed one
+ */
+struct LabelScope {
+    std::string name;
+    size_t unnamed;             // .local scopes opened so far, used to name them
+};
+
+void assemble(const SourceLine& line);
 void dumpSymbolTable();
 
 void setOutFile(std::string ofname);
 void setProgramStart(uint16_t origin);
 
+/**
+ * setCompression(): make close() write the image packed (see compress.h), behind a two byte
+ * unpack address. selfExtract writes a PRG that loads at stubAddress instead, unpacks itself
+ * and jumps to the program start
+ */
+void setCompression(bool compress, bool selfExtract, uint16_t stubAddress);
+
+/**
+ * setWriteThrough(): write emitted bytes to the output file as they come instead of all at once in
+ * close(), for the streaming driver, which emits from a single thread. Only uncompressed output
+ * can be written this way. If a later segment starts below the first byte written, the load
+ * address changes and close() writes the whole file again
+ */
+void setWriteThrough(bool on);
+
 void close();
 void startNextPass();
 bool isSuccessfulAssembly();
 
-#endif
\ No newline at end of file
+/**
+ * classifyLine(): tokenize a line and build its instruction packet without touching any
+ * assembler state. Safe to call from several threads at once
+ */
+LineRecord classifyLine(std::string line);
+
+/**
+ * recordSize(): number of bytes a classified line adds to the program
+ */
+size_t recordSize(const LineRecord& rec);
+
+/**
+ * enterScope(): update scope for a classified line and qualify the @local labels it defines or
+ * refers to with the scope name. Drivers call this for every line that defines a label, opens
+ * a scope or refers to a local label, in program order, before defineLabel()/resolveLabel()
+ */
+void enterScope(LabelScope& scope, LineRecord& rec);
+
+/**
+ * needsScope(): true if enterScope() would do anything for this line
+ */
+bool needsScope(const LineRecord& rec);
+
+/**
+ * defineLabel(): add a label to the symbol table. Anonymous + and - labels are kept in lists
+ * instead, by line, the index of the defining line in the program. Labels are defined in program
+ * order. returns false if the label was already defined
+ */
+bool defineLabel(std::string label, uint16_t address, size_t line);
+
+/**
+ * finishLabels(): called once every label is defined. Forward anonymous references do not resolve
+ * until then, backward ones resolve as soon as their label is defined
+ */
+void finishLabels();
+
+/**
+ * resolveLabel(): fill in the argument of a label type instruction located at address pc, on the
+ * line with index line in the program. Anonymous references count labels by line, not by address,
+ * so they never reach into another segment that happens to be closer. Only reads the symbol table,
+ * so it may be called from several threads once pass one is done.
+ * Labels the program does not define are looked up in the symbol snapshots, unless useSnapshots
+ * is false - a driver that resolves before every label is defined must not let a snapshot win
+ * over a program label that comes later.
+ * returns an error message, or an empty string on success
+ */
+std::string resolveLabel(InstructionPacket& ip, uint16_t pc, size_t line, bool useSnapshots = true);
+
+/**
+ * setLabelArgument(): fill in the argument of a label type instruction located at pc whose label
+ * is at address. returns an error message, or an empty string on success
+ */
+std::string setLabelArgument(InstructionPacket& ip, uint16_t pc, uint16_t address);
+
+/**
+ * encodeInstruction(): write the bytes of an instruction to out (at least 3 bytes long).
+ * returns the number of bytes written
+ */
+int encodeInstruction(InstructionPacket ip, uint8_t *out);
+
+/**
+ * emitBytes(): write bytes into the program image at address on behalf of the line at owner.
+ * Safe to call from several threads as long as they write to different addresses, unless
+ * setWriteThrough() is on
+ * returns: an error message if the bytes overlap earlier output or run off the end of memory,
+ * otherwise an empty string. overlapping bytes are written anyway, bytes that would run off the
+ * end of memory are not written at all
+ */
+std::string emitBytes(uint32_t address, const uint8_t *bytes, size_t size, ByteOwner owner);
+
+/**
+ * patchBytes(): overwrite bytes emitted before, to backpatch a forward reference
+ */
+void patchBytes(uint16_t address, const uint8_t *bytes, size_t size);
+
+/**
+ * getProgramImage(): the 64K image every driver assembles into. close() writes it out
+ */
+MemoryImage& getProgramImage();
+
+/**
+ * getSymbolTable(): every label the program defined. Labels loaded from symbol snapshots are
+ * not in here, see symfile.h
+ */
+const std::map<std::string, uint16_t>& getSymbolTable();
+
+#endif
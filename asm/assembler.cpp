@@ -9,6 +9,7 @@
 #include <iostream>
 
 #include "ltokenizer.h"
+#include "diagnostics.h"
 
 enum ArgumentType {
     NoArgument, ImmediateValue,
@@ -354,10 +355,10 @@ ArgumentType getOpcodeArgumentType(std::string argument) {
 }
 
 void error(std::string errmsg) {
-    std::cout << "Line " << lineNumber << " - error: " << errmsg << std::endl;
+    reportDiagnostic(SeverityError, lineNumber, 0, errmsg);
     successful = false;
 }
 
 void warn(std::string warning) {
-    std::cout << "Line " << lineNumber << " - warning: " << warning << std::endl;
+    reportDiagnostic(SeverityWarning, lineNumber, 0, warning);
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "compress.h"
+#include "asm.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+
+using namespace std;
+
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 0x7f + MIN_MATCH;
+static const size_t MAX_LITERALS = 0x7f;
+static const size_t MAX_OFFSET = 0xffff;
+
+// candidates looked at per position. a longer chain finds a few more matches on large inputs,
+// at a cost that grows with it
+static const size_t CHAIN_DEPTH = 64;
+static const size_t HASH_SIZE = 1 << 15;
+
+static size_t hashAt(const uint8_t *p) {
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+// how one position is encoded in the cheapest parse of the data from there to the end
+struct ParseStep {
+    size_t cost;                // packed bytes from here to the end, end marker included
+    size_t length;
+    size_t offset;              // 0 for a literal run
+};
+
+// see API note in compress.h
+vector<uint8_t> compressData(const uint8_t *data, size_t size) {
+    // longest match for every position, found through chains of earlier positions with the same hash
+    vector<size_t> matchLength(size, 0), matchOffset(size, 0);
+    vector<long> head(HASH_SIZE, -1), previous(size, -1);
+
+    for (size_t i = 0; i + MIN_MATCH <= size; i++) {
+        size_t h = hashAt(data + i);
+        size_t limit = min(MAX_MATCH, size - i);
+
+        size_t depth = 0;
+        for (long j = head[h]; j >= 0 && depth < CHAIN_DEPTH && i - j <= MAX_OFFSET; j = previous[j], depth++) {
+            // a candidate that differs at the end of the best match so far cannot beat it
+            if (matchLength[i] > 0 && data[j + matchLength[i]] != data[i + matchLength[i]]) continue;
+
+            size_t length = 0;
+            while (length < limit && data[j + length] == data[i + length]) length++;
+
+            if (length > matchLength[i]) {
+                matchLength[i] = length;
+                matchOffset[i] = i - j;
+                if (length == limit) break;
+            }
+        }
+
+        previous[i] = head[h];
+        head[h] = (long) i;
+    }
+
+    // the parse is optimal for the matches found: walking backwards, every position picks the
+    // literal run or match length that makes the rest of the data cheapest
+    vector<ParseStep> steps(size + 1);
+    steps[size] = { 1, 0, 0 };
+    for (size_t i = size; i-- > 0;) {
+        ParseStep best = { (size_t) -1, 0, 0 };
+
+        for (size_t run = 1; run <= MAX_LITERALS && i + run <= size; run++) {
+            size_t cost = 1 + run + steps[i + run].cost;
+            if (cost < best.cost) best = { cost, run, 0 };
+        }
+
+        for (size_t length = MIN_MATCH; length <= matchLength[i]; length++) {
+            size_t cost = 3 + steps[i + length].cost;
+            if (cost < best.cost) best = { cost, length, matchOffset[i] };
+        }
+
+        steps[i] = best;
+    }
+
+    vector<uint8_t> packed;
+    packed.reserve(steps[0].cost);
+    for (size_t i = 0; i < size; i += steps[i].length) {
+        const ParseStep& step = steps[i];
+        if (step.offset == 0) {
+            packed.push_back((uint8_t) step.length);
+            packed.insert(packed.end(), data + i, data + i + step.length);
+        } else {
+            packed.push_back((uint8_t) (0x80 | (step.length - MIN_MATCH)));
+            packed.push_back((uint8_t) (step.offset & 0xff));
+            packed.push_back((uint8_t) (step.offset >> 8));
+        }
+    }
+
+    packed.push_back(0);
+    return packed;
+}
+
+static string hexByte(unsigned value) {
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "$%02x", value & 0xff);
+    return buffer;
+}
+
+static string hexWord(unsigned value) {
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "$%04x", value & 0xffff);
+    return buffer;
+}
+
+/**
+ * the unpacker, in the assembler's own syntax. the packed data starts at source
+ */
+static string unpackStubSource(uint16_t source, uint16_t destination, uint16_t entry) {
+    ostringstream s;
+    s << "    lda #" << hexByte(source) << "\n"
+      << "    sta $fb\n"
+      << "    lda #" << hexByte(source >> 8) << "\n"
+      << "    sta $fc\n"
+      << "    lda #" << hexByte(destination) << "\n"
+      << "    sta $fd\n"
+      << "    lda #" << hexByte(destination >> 8) << "\n"
+      << "    sta $fe\n"
+      << "    ldy #$00\n"
+      << "token:\n"
+      << "    jsr getbyte\n"
+      << "    tax\n"
+      << "    beq done\n"
+      << "    bmi match\n"
+      << "literal:\n"
+      << "    jsr getbyte\n"
+      << "    sta ($fd),y\n"
+      << "    jsr incdest\n"
+      << "    dex\n"
+      << "    bne literal\n"
+      << "    beq token\n"
+      << "match:\n"
+      << "    jsr getbyte\n"                // copy source = destination - offset
+      << "    sta $f9\n"
+      << "    jsr getbyte\n"
+      << "    sta $fa\n"
+      << "    sec\n"
+      << "    lda $fd\n"
+      << "    sbc $f9\n"
+      << "    sta $f9\n"
+      << "    lda $fe\n"
+      << "    sbc $fa\n"
+      << "    sta $fa\n"
+      << "    txa\n"
+      << "    and #$7f\n"
+      << "    clc\n"
+      << "    adc #" << hexByte(MIN_MATCH) << "\n"
+      << "    tax\n"
+      << "copy:\n"
+      << "    lda ($f9),y\n"
+      << "    sta ($fd),y\n"
+      << "    inc $f9\n"
+      << "    bne copynext\n"
+      << "    inc $fa\n"
+      << "copynext:\n"
+      << "    jsr incdest\n"
+      << "    dex\n"
+      << "    bne copy\n"
+      << "    beq token\n"
+      << "done:\n"
+      << "    jmp " << hexWord(entry) << "\n"
+      << "getbyte:\n"                       // flags do not follow the byte read, callers use tax
+      << "    lda ($fb),y\n"
+      << "    inc $fb\n"
+      << "    bne getbytedone\n"
+      << "    inc $fc\n"
+      << "getbytedone:\n"
+      << "    rts\n"
+      << "incdest:\n"
+      << "    inc $fd\n"
+      << "    bne incdestdone\n"
+      << "    inc $fe\n"
+      << "incdestdone:\n"
+      << "    rts\n";
+    return s.str();
+}
+
+/**
+ * assemble a self contained piece of code at address, with labels of its own. nothing is written
+ * to the program image or the symbol table
+ */
+static string assembleSnippet(const string& source, uint16_t address, vector<uint8_t>& out) {
+    vector<LineRecord> records;
+    map<string, uint16_t> labels;
+    uint32_t pc = address;
+
+    istringstream in(source);
+    string line;
+    while (getline(in, line)) {
+        LineRecord rec = classifyLine(line);
+        if (!rec.error.empty()) return rec.error + " in unpack stub: " + line;
+
+        if (!rec.label.empty()) labels[rec.label] = (uint16_t) pc;
+        pc += recordSize(rec);
+        records.push_back(rec);
+    }
+
+    out.clear();
+    pc = address;
+    for (LineRecord& rec : records) {
+        if (!rec.hasInstruction) continue;
+
+        if (rec.ip.isLabelType) {
+            auto it = labels.find(rec.ip.label);
+            if (it == labels.end()) return "Unknown label " + rec.ip.label + " in unpack stub";
+
+            string msg = setLabelArgument(rec.ip, (uint16_t) pc, it->second);
+            if (!msg.empty()) return msg + " in unpack stub";
+        }
+
+        uint8_t bytes[3];
+        int size = encodeInstruction(rec.ip, bytes);
+        out.insert(out.end(), bytes, bytes + size);
+        pc += size;
+    }
+
+    return "";
+}
+
+// see API note in compress.h
+string buildUnpackStub(uint16_t address, uint16_t destination, uint16_t entry, vector<uint8_t>& stub) {
+    // the stub's size does not depend on the addresses in it, so a first round finds where the
+    // packed data will start
+    string msg = assembleSnippet(unpackStubSource(0, destination, entry), address, stub);
+    if (!msg.empty()) return msg;
+
+    return assembleSnippet(unpackStubSource((uint16_t) (address + stub.size()), destination, entry), address, stub);
+}
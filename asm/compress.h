@@ -0,0 +1,35 @@
+#ifndef _6502_COMPRESS_H
+#define _6502_COMPRESS_H
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The packed format is a byte aligned LZ77 that a few dozen bytes of 6502 code can unpack:
+ *
+ *   $00            end of data
+ *   $01-$7f        that many literal bytes follow
+ *   $80-$ff lo hi  copy (token & $7f) + 3 bytes from hi:lo bytes back in the output
+ *
+ * Copies run forwards a byte at a time, so a copy may overlap the bytes it produces.
+ */
+
+/**
+ * compressData(): pack size bytes with an optimal parse over hash chain matches
+ * returns: the packed stream, including the end marker
+ */
+std::vector<uint8_t> compressData(const uint8_t *data, size_t size);
+
+/**
+ * buildUnpackStub(): assemble the self extracting stub that loads at address, unpacks the data
+ * appended right behind it to destination and jumps to entry. The stub keeps its pointers in
+ * zero page $f9-$fe
+ * outputs: stub - the machine code
+ * returns: an error message, or an empty string on success
+ */
+std::string buildUnpackStub(uint16_t address, uint16_t destination, uint16_t entry, std::vector<uint8_t>& stub);
+
+#endif
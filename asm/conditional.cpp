@@ -0,0 +1,143 @@
+#include "conditional.h"
+#include "ltokenizer.h"
+#include "diagnostics.h"
+#include "opcode.h"
+
+#include <map>
+
+using namespace std;
+
+extern string tolower(string s);
+
+// symbol names are matched case insensitively, like the rest of the source
+static map<string, uint16_t> symbols;
+
+void defineSymbol(string name, uint16_t value) {
+    symbols[tolower(name)] = value;
+}
+
+/**
+ * the cheap part of the scanner: if the line starts with a directive, return its lower case keyword,
+ * otherwise an empty string. nothing past the first word is looked at
+ */
+static string directiveKeyword(string_view line) {
+    size_t i = 0;
+    while (i < line.size() && isspace((unsigned char) line[i])) i++;
+    if (i >= line.size() || line[i] != '.') return "";
+
+    size_t start = i;
+    while (i < line.size() && !isspace((unsigned char) line[i]) && line[i] != ';') i++;
+    return tolower(string(line.substr(start, i - start)));
+}
+
+static bool isConditional(const string& keyword) {
+    return (keyword == ".if" || keyword == ".ifdef" || keyword == ".ifndef" || keyword == ".else" || keyword == ".endif");
+}
+
+/**
+ * value of a condition operand: a number or a defined symbol
+ */
+static bool operandValue(const string& token, uint16_t& value) {
+    uint32_t number;
+    if (parseNumber(token, number)) {
+        value = (uint16_t) number;
+        return true;
+    }
+
+    auto it = symbols.find(token);
+    if (it == symbols.end()) return false;
+
+    value = it->second;
+    return true;
+}
+
+bool ConditionalState::evaluate(const string& line, const string& keyword, const string& file, size_t lineNo) {
+    LineTokenizer lt(line);
+    lt.nextToken();
+
+    string name = lt.nextToken();
+    if (name.empty()) {
+        reportDiagnostic(SeverityError, file, lineNo, 0, "Missing condition after " + keyword);
+        return false;
+    }
+
+    if (keyword == ".ifdef") return (symbols.find(name) != symbols.end());
+    if (keyword == ".ifndef") return (symbols.find(name) == symbols.end());
+
+    // .if value, .if value == value, .if value != value
+    string op = lt.nextToken(), right = lt.nextToken();
+    uint16_t a = 0, b = 0;
+    if (!operandValue(name, a) || (!op.empty() && !operandValue(right, b))) {
+        reportDiagnostic(SeverityError, file, lineNo, 0, "Undefined symbol in condition");
+        return false;
+    }
+
+    if (op.empty()) return (a != 0);
+    if (op == "==") return (a == b);
+    if (op == "!=") return (a != b);
+
+    reportDiagnostic(SeverityError, file, lineNo, 0, "Unknown condition operator " + op);
+    return false;
+}
+
+// see API note in conditional.h
+bool ConditionalState::consumeLine(string_view line, const string& file, size_t lineNo) {
+    // fast path: anything that is not a directive is assembled or skipped as a whole
+    string keyword = directiveKeyword(line);
+    if (keyword.empty() || (!isConditional(keyword) && keyword != ".define")) return !active();
+
+    bool opensBlock = (keyword == ".if" || keyword == ".ifdef" || keyword == ".ifndef");
+    if (!active()) {
+        // blocks nested in a switched off block are only counted, their conditions are never evaluated
+        if (opensBlock) {
+            skippedDepth++;
+            return true;
+        }
+        if (keyword == ".endif" && skippedDepth > 0) {
+            skippedDepth--;
+            return true;
+        }
+
+        // only the .else/.endif of the switched off block itself gets past here
+        if (skippedDepth > 0 || keyword == ".define") return true;
+    }
+
+    if (keyword == ".define") {
+        LineTokenizer lt{string(line)};
+        lt.nextToken();
+        string name = lt.nextToken(), value = lt.nextToken();
+        uint16_t v = 1;
+        if (name.empty() || (!value.empty() && !operandValue(value, v))) {
+            reportDiagnostic(SeverityError, file, lineNo, 0, "Expected .define name [value]");
+        } else {
+            symbols[name] = v;
+        }
+    } else if (opensBlock) {
+        bool result = evaluate(string(line), keyword, file, lineNo);
+        blocks.push_back({ result, result, false, &file, lineNo });
+    } else if (blocks.empty()) {
+        reportDiagnostic(SeverityError, file, lineNo, 0, keyword + " without .if");
+    } else if (keyword == ".else") {
+        Block& block = blocks.back();
+        if (block.seenElse) reportDiagnostic(SeverityError, file, lineNo, 0, "Duplicate .else");
+
+        // blocks only get onto the stack inside active code, so the else branch runs
+        // whenever the if branch did not
+        block.active = !block.taken;
+        block.taken = true;
+        block.seenElse = true;
+    } else {
+        blocks.pop_back();
+    }
+
+    return true;
+}
+
+// see API note in conditional.h
+void ConditionalState::finish() {
+    for (const Block& block : blocks) {
+        reportDiagnostic(SeverityError, *block.file, block.line, 0, "Unterminated conditional block");
+    }
+    blocks.clear();
+    skippedDepth = 0;
+}
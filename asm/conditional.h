@@ -0,0 +1,54 @@
+#ifndef _6502_CONDITIONAL_H
+#define _6502_CONDITIONAL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * defineSymbol(): define a symbol for .ifdef/.if, as -D on the command line or .define in the source does
+ */
+void defineSymbol(std::string name, uint16_t value);
+
+/**
+ * ConditionalState: tracks .if/.ifdef/.ifndef/.else/.endif nesting while lines are fed through it in
+ * program order. Lines in blocks that are switched off are recognised by looking at their first
+ * character and, for directives, their first word only; they are never tokenized or classified.
+ * .define lines are handled here as well, so they are seen in the same order as the conditions.
+ */
+class ConditionalState {
+public:
+
+    /**
+     * consumeLine(): feed the next program line through the conditional state
+     * returns: true if the line is used up by conditional assembly (a conditional directive, a .define,
+     * or a line in a block that is switched off) and must not be assembled
+     */
+    bool consumeLine(std::string_view line, const std::string& file, size_t lineNo);
+
+    /**
+     * finish(): report blocks left open at the end of the program
+     */
+    void finish();
+
+private:
+
+    struct Block {
+        bool active;            // lines in the current branch are assembled
+        bool taken;             // some branch of this block was active
+        bool seenElse;
+        const std::string *file;
+        size_t line;
+    };
+
+    bool active() const { return blocks.empty() || blocks.back().active; }
+    bool evaluate(const std::string& line, const std::string& keyword, const std::string& file, size_t lineNo);
+
+    std::vector<Block> blocks;
+    size_t skippedDepth = 0;    // blocks opened inside a block that is switched off
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "diagnostics.h"
+
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct Diagnostic {
+    Severity severity;
+    string file;
+    size_t line, column;
+    string message;
+    size_t count;               // how many times the message was reported in the file
+};
+
+static DiagnosticFormat format = TextDiagnostics;
+static size_t maxErrors = 0, errors = 0;
+static string sourceFile = "";
+
+static vector<Diagnostic> diagnostics;
+static unordered_map<string, size_t> seen;         // diagnostic key -> index into diagnostics
+static mutex diagnosticsMutex;
+
+void setDiagnosticFormat(DiagnosticFormat fmt) { format = fmt; }
+void setMaxErrors(size_t max) { maxErrors = max; }
+void setDiagnosticSource(string file) { sourceFile = file; }
+
+size_t errorCount() {
+    lock_guard<mutex> lock(diagnosticsMutex);
+    return errors;
+}
+
+bool errorLimitReached() {
+    lock_guard<mutex> lock(diagnosticsMutex);
+    return (maxErrors != 0 && errors >= maxErrors);
+}
+
+// see API note in diagnostics.h
+bool holdsEnoughErrors(size_t held) {
+    lock_guard<mutex> lock(diagnosticsMutex);
+    return (maxErrors != 0 && errors + held >= maxErrors);
+}
+
+// see API note in diagnostics.h
+void reportDiagnostic(Severity severity, string file, size_t line, size_t column, string message) {
+    lock_guard<mutex> lock(diagnosticsMutex);
+
+    if (severity == SeverityError && maxErrors != 0 && errors >= maxErrors) return;
+
+    ostringstream key;
+    key << severity << ':' << file << ':' << message;
+    auto it = seen.find(key.str());
+    if (it != seen.end()) {
+        diagnostics[it->second].count++;
+        return;
+    }
+
+    seen[key.str()] = diagnostics.size();
+    diagnostics.push_back({ severity, file, line, column, message, 1 });
+    if (severity == SeverityError && ++errors == maxErrors) {
+        diagnostics.push_back({ SeverityError, file, 0, 0, "too many errors, stopping", 1 });
+    }
+}
+
+void reportDiagnostic(Severity severity, size_t line, size_t column, string message) {
+    reportDiagnostic(severity, sourceFile, line, column, message);
+}
+
+static string jsonString(const string& s) {
+    string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            const char *hex = "0123456789abcdef";
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static const char *severityName(Severity severity) {
+    return (severity == SeverityError) ? "error" : "warning";
+}
+
+// see API note in diagnostics.h
+void flushDiagnostics(ostream& out) {
+    lock_guard<mutex> lock(diagnosticsMutex);
+    ostringstream buf;
+
+    if (format == JsonDiagnostics) {
+        buf << "[";
+        for (size_t i = 0; i < diagnostics.size(); i++) {
+            const Diagnostic& d = diagnostics[i];
+            buf << ((i == 0) ? "\n" : ",\n")
+                << "  {\"severity\": \"" << severityName(d.severity) << "\", \"file\": " << jsonString(d.file)
+                << ", \"line\": " << d.line << ", \"column\": " << d.column
+                << ", \"message\": " << jsonString(d.message) << ", \"count\": " << d.count << "}";
+        }
+        buf << "\n]\n";
+    } else {
+        for (const Diagnostic& d : diagnostics) {
+            buf << d.file;
+            if (d.line != 0) buf << ":" << d.line;
+            if (d.column != 0) buf << ":" << d.column;
+            buf << ": " << severityName(d.severity) << ": " << d.message;
+            if (d.count > 1) buf << " (repeated " << d.count << " times)";
+            buf << "\n";
+        }
+    }
+
+    string text = buf.str();
+    out.write(text.data(), text.size());
+    out.flush();
+
+    diagnostics.clear();
+    seen.clear();
+}
@@ -0,0 +1,56 @@
+#ifndef _6502_DIAGNOSTICS_H
+#define _6502_DIAGNOSTICS_H
+
+#include <ostream>
+#include <string>
+
+#include <cstddef>
+
+enum Severity {
+    SeverityWarning, SeverityError
+};
+
+enum DiagnosticFormat {
+    TextDiagnostics, JsonDiagnostics
+};
+
+/**
+ * Diagnostics are collected in memory and written out in one go by flushDiagnostics(), so a source
+ * with a huge number of errors does not pay for a flush per message. A message repeated in the same
+ * file is kept once, at the location it was first reported for, with a repeat count.
+ */
+void setDiagnosticFormat(DiagnosticFormat format);
+
+/**
+ * setMaxErrors(): stop collecting errors after max of them. 0 means no limit
+ */
+void setMaxErrors(size_t max);
+
+/**
+ * setDiagnosticSource(): name of the file reported with diagnostics that do not give their own
+ */
+void setDiagnosticSource(std::string file);
+
+/**
+ * reportDiagnostic(): record a message. line and column count from 1, 0 means unknown.
+ * Safe to call from several threads at once
+ */
+void reportDiagnostic(Severity severity, std::string file, size_t line, size_t column, std::string message);
+void reportDiagnostic(Severity severity, size_t line, size_t column, std::string message);
+
+size_t errorCount();
+bool errorLimitReached();
+
+/**
+ * holdsEnoughErrors(): for drivers that hold errors back to report them in source order. true once
+ * held errors in source order, together with the ones already reported, reach the error limit, so
+ * any later error could not be reported and need not be stored
+ */
+bool holdsEnoughErrors(size_t held);
+
+/**
+ * flushDiagnostics(): write every collected diagnostic to out and clear the collector
+ */
+void flushDiagnostics(std::ostream& out);
+
+#endif
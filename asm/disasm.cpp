@@ -0,0 +1,181 @@
+#include "disasm.h"
+#include "opcode.h"
+
+#include <cctype>
+#include <cstring>
+
+using namespace std;
+
+extern const Mnemonic opcodeMatrix[16][16];
+extern string tolower(string s);
+
+enum OperandFormat {
+    NoOperand, Immediate, ZeroPage, ZeroPageX, ZeroPageY, Absolute, AbsoluteX, AbsoluteY,
+    IndexedIndirect, IndirectIndexed, Indirect, Relative, DataByte
+};
+
+struct DecodeEntry {
+    char text[6];               // lower case mnemonic and a space, ready to copy out
+    uint8_t size;
+    OperandFormat format;
+};
+
+// the longest line: "c000  bd 20 d0  lda $d020,x\n" with room to spare
+static const size_t MAX_LINE = 40;
+static const char hexDigits[] = "0123456789abcdef";
+
+static OperandFormat operandFormat(const string& addrmode) {
+    if (addrmode.empty()) return NoOperand;
+    if (addrmode == "imm") return Immediate;
+    if (addrmode == "zp") return ZeroPage;
+    if (addrmode == "zpx") return ZeroPageX;
+    if (addrmode == "zpy") return ZeroPageY;
+    if (addrmode == "abs") return Absolute;
+    if (addrmode == "abx") return AbsoluteX;
+    if (addrmode == "aby") return AbsoluteY;
+    if (addrmode == "izx") return IndexedIndirect;
+    if (addrmode == "izy") return IndirectIndexed;
+    if (addrmode == "ind") return Indirect;
+    if (addrmode == "rel") return Relative;
+    return DataByte;
+}
+
+static uint8_t operandSize(OperandFormat format) {
+    switch (format) {
+        case NoOperand: case DataByte: return 1;
+        case Absolute: case AbsoluteX: case AbsoluteY: case Indirect: return 3;
+        default: return 2;
+    }
+}
+
+/**
+ * build the opcode byte -> instruction table from the matrix. illegal and undocumented opcodes
+ * (marked with ; or * in the matrix) decode as data
+ */
+static const DecodeEntry *decodeTable() {
+    static DecodeEntry table[256];
+    static bool built = [] {
+        for (size_t op = 0; op < 256; op++) {
+            const Mnemonic& m = opcodeMatrix[op / 16][op % 16];
+            DecodeEntry& e = table[op];
+
+            e.format = operandFormat(m.addrmode);
+            if (m.mnemonic.size() != 3 || !isalpha((unsigned char) m.mnemonic[0])) e.format = DataByte;
+
+            string text = (e.format == DataByte) ? ".db " : tolower(m.mnemonic) + " ";
+            memcpy(e.text, text.c_str(), 5);
+            e.size = operandSize(e.format);
+        }
+        return true;
+    }();
+
+    (void) built;
+    return table;
+}
+
+static inline char *putHex8(char *p, uint8_t value) {
+    *p++ = hexDigits[value >> 4];
+    *p++ = hexDigits[value & 0xf];
+    return p;
+}
+
+static inline char *putHex16(char *p, uint16_t value) {
+    return putHex8(putHex8(p, (uint8_t) (value >> 8)), (uint8_t) value);
+}
+
+static inline char *putString(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// see API note in disasm.h
+size_t disassemble(const uint8_t *image, size_t size, uint16_t origin, DisassemblyFormat format, string& out) {
+    const DecodeEntry *table = decodeTable();
+
+    // every instruction is at least one byte long, so this is enough room for the whole image
+    size_t start = out.size();
+    out.resize(start + size * MAX_LINE);
+    char *base = &out[0];
+    char *p = base + start;
+
+    size_t pos = 0, lines = 0;
+    while (pos < size) {
+        const DecodeEntry& e = table[image[pos]];
+        uint16_t address = (uint16_t) (origin + pos);
+
+        // an instruction cut off by the end of the image is written as data
+        bool truncated = (pos + e.size > size);
+        OperandFormat fmt = truncated ? DataByte : e.format;
+        size_t length = truncated ? 1 : e.size;
+
+        uint8_t lo = (length > 1) ? image[pos + 1] : 0;
+        uint8_t hi = (length > 2) ? image[pos + 2] : 0;
+
+        if (format == ListingFormat) {
+            p = putHex16(p, address);
+            p = putString(p, "  ", 2);
+            for (size_t i = 0; i < 3; i++) {
+                if (i < length) p = putHex8(p, image[pos + i]);
+                else p = putString(p, "  ", 2);
+                *p++ = ' ';
+            }
+            *p++ = ' ';
+        }
+
+        p = putString(p, (fmt == DataByte) ? ".db " : e.text, 4);
+
+        switch (fmt) {
+            case NoOperand:
+                p--;        // drop the space after the mnemonic
+                break;
+            case DataByte:
+                *p++ = '$'; p = putHex8(p, image[pos]);
+                break;
+            case Immediate:
+                p = putString(p, "#$", 2); p = putHex8(p, lo);
+                break;
+            case ZeroPage:
+                *p++ = '$'; p = putHex8(p, lo);
+                break;
+            case ZeroPageX:
+                *p++ = '$'; p = putHex8(p, lo); p = putString(p, ",x", 2);
+                break;
+            case ZeroPageY:
+                *p++ = '$'; p = putHex8(p, lo); p = putString(p, ",y", 2);
+                break;
+            case Absolute:
+                *p++ = '$'; p = putHex16(p, (uint16_t) (lo | (hi << 8)));
+                break;
+            case AbsoluteX:
+                *p++ = '$'; p = putHex16(p, (uint16_t) (lo | (hi << 8))); p = putString(p, ",x", 2);
+                break;
+            case AbsoluteY:
+                *p++ = '$'; p = putHex16(p, (uint16_t) (lo | (hi << 8))); p = putString(p, ",y", 2);
+                break;
+            case IndexedIndirect:
+                p = putString(p, "($", 2); p = putHex8(p, lo); p = putString(p, ",x)", 3);
+                break;
+            case IndirectIndexed:
+                p = putString(p, "($", 2); p = putHex8(p, lo); p = putString(p, "),y", 3);
+                break;
+            case Indirect:
+                p = putString(p, "($", 2); p = putHex16(p, (uint16_t) (lo | (hi << 8))); *p++ = ')';
+                break;
+            case Relative:
+                if (format == ListingFormat) {
+                    // listings show the branch target, source keeps the raw offset form the assembler reads back
+                    *p++ = '$'; p = putHex16(p, (uint16_t) (address + 2 + (int8_t) lo));
+                } else {
+                    p = putString(p, "($", 2); p = putHex8(p, lo); *p++ = ')';
+                }
+                break;
+        }
+
+        *p++ = '\n';
+        pos += length;
+        lines++;
+    }
+
+    out.resize(p - base);
+    return lines;
+}
@@ -0,0 +1,24 @@
+#ifndef _6502_DISASM_H
+#define _6502_DISASM_H
+
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+enum DisassemblyFormat {
+    SourceFormat,           // one instruction per line, in syntax the assembler accepts back
+    ListingFormat           // address and instruction bytes in front of every instruction
+};
+
+/**
+ * disassemble(): decode a program image and append the text to out
+ * inputs: image/size - the program bytes, origin - address of the first byte, format - output layout
+ * returns: the number of lines written
+ *
+ * Decoding is a single lookup per opcode in a 256 entry table built from the opcode matrix. Bytes that
+ * do not start a legal instruction are written as .db lines
+ */
+size_t disassemble(const uint8_t *image, size_t size, uint16_t origin, DisassemblyFormat format, std::string& out);
+
+#endif
@@ -0,0 +1,151 @@
+#include "asm.h"
+#include "disasm.h"
+#include "diagnostics.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+void usage() {
+    std::cerr << "usage: 6502-dis [--raw] [--org address] [--listing] [--verify] [-o outfile] file..." << std::endl
+              << "  files are PRG images (load address first) unless --raw is given" << std::endl;
+}
+
+bool readImage(std::string file, bool raw, uint16_t& org, std::vector<uint8_t>& image) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (!raw) {
+        if (image.size() < 2) return false;
+        org = (uint16_t) (image[0] | (image[1] << 8));
+        image.erase(image.begin(), image.begin() + 2);
+    }
+
+    return true;
+}
+
+/**
+ * disassemble the image, assemble the result again in-process and compare the bytes
+ */
+bool verifyImage(std::string file, uint16_t org, const std::vector<uint8_t>& image, unsigned jobs, size_t& instructions) {
+    if (image.empty()) return true;
+    if (org + image.size() > MemoryImage::SIZE) {
+        std::cerr << file << ": image does not fit in the address space" << std::endl;
+        return false;
+    }
+
+    std::string source;
+    instructions += disassemble(image.data(), image.size(), org, SourceFormat, source);
+
+    SourceFile text;
+    text.path = file;
+    text.text = std::move(source);
+    std::string_view all = text.text;
+    size_t start = 0, end;
+    while ((end = all.find('\n', start)) != std::string_view::npos) {
+        text.lines.push_back(all.substr(start, end - start));
+        start = end + 1;
+    }
+
+    std::vector<SourceLine> program;
+    for (size_t i = 0; i < text.lines.size(); i++) program.push_back({ &text, i + 1 });
+
+    MemoryImage& reassembled = getProgramImage();
+    reassembled.clear();
+    assembleParallel(program, org, jobs);
+
+    size_t low = reassembled.empty() ? 0 : reassembled.lowest();
+    size_t high = reassembled.empty() ? 0 : reassembled.highest() + 1;
+    size_t mismatch = 0;
+    while (mismatch < image.size() && image[mismatch] == reassembled.data()[org + mismatch]) mismatch++;
+
+    if (mismatch == image.size() && low == org && high == org + image.size()) return true;
+
+    std::cerr << file << ": round trip differs at $" << std::hex << (org + mismatch)
+              << " (assembled $" << low << "-$" << high << ")" << std::dec << std::endl;
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> files;
+    std::string outfile;
+    uint16_t rawOrg = 0xc000;
+    bool raw = false, verify = false;
+    DisassemblyFormat format = SourceFormat;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outfile = argv[++i];
+        } else if (arg == "--org" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value[0] == '$') value = value.substr(1);
+            rawOrg = (uint16_t) std::strtoul(value.c_str(), nullptr, 16);
+        } else if (arg == "--raw") {
+            raw = true;
+        } else if (arg == "--listing") {
+            format = ListingFormat;
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg[0] != '-') {
+            files.push_back(arg);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (files.empty()) {
+        usage();
+        return 1;
+    }
+
+    unsigned jobs = std::thread::hardware_concurrency();
+    size_t instructions = 0, failures = 0;
+    std::string text;
+    auto started = std::chrono::steady_clock::now();
+
+    for (const std::string& file : files) {
+        uint16_t org = rawOrg;
+        std::vector<uint8_t> image;
+        if (!readImage(file, raw, org, image)) {
+            std::cerr << "could not read " << file << std::endl;
+            failures++;
+            continue;
+        }
+
+        if (verify) {
+            if (!verifyImage(file, org, image, jobs, instructions)) failures++;
+        } else {
+            if (files.size() > 1) text += "; " + file + "\n";
+            instructions += disassemble(image.data(), image.size(), org, format, text);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    flushDiagnostics(std::cerr);
+
+    if (verify) {
+        std::cout << (files.size() - failures) << " of " << files.size() << " images round trip, "
+                  << instructions << " instructions in " << seconds << "s" << std::endl;
+    } else {
+        FILE *out = outfile.empty() ? stdout : std::fopen(outfile.c_str(), "wb");
+        if (out == nullptr) {
+            std::cerr << "could not write " << outfile << std::endl;
+            return 1;
+        }
+
+        std::fwrite(text.data(), 1, text.size(), out);
+        if (out != stdout) std::fclose(out);
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
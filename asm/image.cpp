@@ -0,0 +1,122 @@
+#include "image.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+using namespace std;
+
+MemoryImage::MemoryImage() {
+    memset(memory, 0, sizeof(memory));
+    for (auto& word : claimed) word.store(0);
+    for (auto& word : dirtyPages) word.store(0);
+}
+
+void MemoryImage::markDirty(uint16_t address, size_t size) {
+    for (size_t page = address / PAGE_SIZE; page <= (address + size - 1) / PAGE_SIZE; page++) {
+        uint64_t bit = (uint64_t) 1 << (page % 64);
+        // only take the atomic read-modify-write when the bit is actually missing
+        if ((dirtyPages[page / 64].load(std::memory_order_relaxed) & bit) == 0) {
+            dirtyPages[page / 64].fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool MemoryImage::pageIsDirty(size_t page) const {
+    return (dirtyPages[page / 64].load(std::memory_order_relaxed) >> (page % 64)) & 1;
+}
+
+bool MemoryImage::isClaimed(size_t address) const {
+    return (claimed[address / 64].load(std::memory_order_relaxed) >> (address % 64)) & 1;
+}
+
+ByteOwner MemoryImage::findOwner(uint16_t address) {
+    size_t page = address / PAGE_SIZE;
+    lock_guard<mutex> lock(spanLocks[page]);
+
+    // spans are kept in the order they were written, so the first one that covers the byte claimed it
+    for (const Span& span : spans[page]) {
+        if (address >= span.address && address < span.address + span.size) return span.owner;
+    }
+    return { nullptr, 0 };
+}
+
+bool MemoryImage::write(uint16_t address, const uint8_t *bytes, size_t size, ByteOwner owner, ByteOwner& collision) {
+    if (size == 0) return true;
+
+    // the span goes in before the bytes are claimed, so a later write that runs into them finds it
+    for (size_t page = address / PAGE_SIZE; page <= (address + size - 1) / PAGE_SIZE; page++) {
+        lock_guard<mutex> lock(spanLocks[page]);
+        spans[page].push_back({ address, size, owner });
+    }
+
+    bool clean = true;
+    size_t first = 0;
+    for (size_t a = address; a < (size_t) address + size; ) {
+        size_t bit = a % 64, count = min(64 - bit, address + size - a);
+        uint64_t mask = (count == 64 ? ~(uint64_t) 0 : (((uint64_t) 1 << count) - 1)) << bit;
+        uint64_t taken = claimed[a / 64].fetch_or(mask, std::memory_order_relaxed) & mask;
+
+        if (taken != 0 && clean) {
+            first = a - bit;
+            while ((taken & 1) == 0) {
+                taken >>= 1;
+                first++;
+            }
+            clean = false;
+        }
+        a += count;
+    }
+
+    memcpy(memory + address, bytes, size);
+    markDirty(address, size);
+    if (!clean) collision = findOwner((uint16_t) first);
+    return clean;
+}
+
+void MemoryImage::store(uint16_t address, const uint8_t *bytes, size_t size) {
+    if (size == 0) return;
+
+    memcpy(memory + address, bytes, size);
+    markDirty(address, size);
+}
+
+bool MemoryImage::empty() const {
+    for (auto& word : dirtyPages) {
+        if (word.load(std::memory_order_relaxed) != 0) return false;
+    }
+    return true;
+}
+
+uint16_t MemoryImage::lowest() const {
+    // the page bitmap finds the first touched page, the byte bitmap finds the byte inside it
+    for (size_t page = 0; page < SIZE / PAGE_SIZE; page++) {
+        if (!pageIsDirty(page)) continue;
+        for (size_t a = page * PAGE_SIZE; a < (page + 1) * PAGE_SIZE; a++) {
+            if (isClaimed(a)) return (uint16_t) a;
+        }
+        return (uint16_t) (page * PAGE_SIZE);
+    }
+    return 0;
+}
+
+uint16_t MemoryImage::highest() const {
+    for (size_t page = SIZE / PAGE_SIZE; page-- > 0; ) {
+        if (!pageIsDirty(page)) continue;
+        for (size_t a = (page + 1) * PAGE_SIZE; a-- > page * PAGE_SIZE; ) {
+            if (isClaimed(a)) return (uint16_t) a;
+        }
+        return (uint16_t) ((page + 1) * PAGE_SIZE - 1);
+    }
+    return 0;
+}
+
+void MemoryImage::clear() {
+    for (size_t page = 0; page < SIZE / PAGE_SIZE; page++) {
+        if (!pageIsDirty(page)) continue;
+        memset(memory + page * PAGE_SIZE, 0, PAGE_SIZE);
+        spans[page].clear();
+    }
+    for (auto& word : claimed) word.store(0);
+    for (auto& word : dirtyPages) word.store(0);
+}
@@ -0,0 +1,79 @@
+#ifndef _6502_IMAGE_H
+#define _6502_IMAGE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// the source line that emitted a byte. file is nullptr for bytes nobody has written
+struct ByteOwner {
+    const std::string *file;
+    size_t line;
+};
+
+/**
+ * MemoryImage: the whole 64K address space of the target. A bitmap with one bit per byte tracks
+ * which bytes were claimed, and every write leaves a span in the pages it touches, so overlapping
+ * segments can be reported with both lines. The spans are only searched when an overlap is found.
+ * A second bitmap of the 256 pages tracks which parts of the space were touched. Writes to different
+ * addresses may come from different threads.
+ */
+class MemoryImage {
+public:
+
+    static const size_t SIZE = 0x10000;
+    static const size_t PAGE_SIZE = 0x100;
+
+    MemoryImage();
+
+    /**
+     * write(): store bytes at address and claim them for owner
+     * outputs: collision - the owner of the first byte that was already claimed
+     * returns: false if any of the bytes had already been written. the bytes are stored anyway
+     */
+    bool write(uint16_t address, const uint8_t *bytes, size_t size, ByteOwner owner, ByteOwner& collision);
+
+    /**
+     * store(): overwrite bytes without claiming them, for backpatching
+     */
+    void store(uint16_t address, const uint8_t *bytes, size_t size);
+
+    bool empty() const;
+
+    // lowest and highest (inclusive) addresses written. only meaningful if the image is not empty
+    uint16_t lowest() const;
+    uint16_t highest() const;
+
+    const uint8_t *data() const { return memory; }
+
+    /**
+     * clear(): forget everything written. only the dirty pages are wiped
+     */
+    void clear();
+
+private:
+
+    // the bytes one write claimed
+    struct Span {
+        uint16_t address;
+        size_t size;
+        ByteOwner owner;
+    };
+
+    void markDirty(uint16_t address, size_t size);
+    bool pageIsDirty(size_t page) const;
+    bool isClaimed(size_t address) const;
+    ByteOwner findOwner(uint16_t address);
+
+    uint8_t memory[SIZE];
+    std::atomic<uint64_t> claimed[SIZE / 64];
+    std::atomic<uint64_t> dirtyPages[SIZE / PAGE_SIZE / 64];
+    std::vector<Span> spans[SIZE / PAGE_SIZE];
+    std::mutex spanLocks[SIZE / PAGE_SIZE];
+};
+
+#endif
@@ -1,6 +1,5 @@
 #include "ltokenizer.h"
 
-#include <sstream>
 #include <algorithm>
 #include <string>
 #include <cctype>
@@ -29,39 +28,58 @@ std::string convertWhitespace(std::string s) {
 
 extern std::string tolower(std::string inp);
 
-// modify later to handle single- and double-quoted strings
+// quoted strings (file names, text) keep their case
 bool canLowercaseToken(std::string token) {
-    return true;
+    return (token[0] != '"' && token[0] != '\'');
 }
 
 LineTokenizer::LineTokenizer(std::string line) {
     // format the line contents, pull out the tokens
     this->convertedString = convertWhitespace(line);
-    std::string s = this->convertedString;
+    this->column = 0;
+    const std::string& s = this->convertedString;
 
-    std::stringstream ss(s);
-    std::string token;
+    size_t i = 0;
+    while (i < s.size()) {
+        // tokens are separated by runs of spaces
+        while (i < s.size() && s[i] == ' ') i++;
+        if (i >= s.size()) break;
 
-    while (ss.good()) {
-        ss >> token;
+        size_t start = i;
+        while (i < s.size() && s[i] != ' ') i++;
+
+        std::string token = s.substr(start, i - start);
         if (token[0] == ';') break;
 
         if (canLowercaseToken(token)) {
             token = tolower(token);
         }
-        
+
         tokenQueue.push(token);
+        columnQueue.push(start + 1);
     }
 
     tokenQueue.push("");
+    columnQueue.push(0);
 }
 
 std::string LineTokenizer::nextToken() {
     std::string retval = this->tokenQueue.front();
-    this->tokenQueue.pop();
+    this->column = this->columnQueue.front();
+
+    // the empty token marks the end of the line and can be read any number of times
+    if (this->tokenQueue.size() > 1) {
+        this->tokenQueue.pop();
+        this->columnQueue.pop();
+    }
+
     return retval;
 }
 
+size_t LineTokenizer::lastColumn() {
+    return this->column;
+}
+
 std::string LineTokenizer::getConvertedString() {
     return this->convertedString;
 }
\ No newline at end of file
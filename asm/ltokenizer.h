@@ -11,9 +11,14 @@ public:
     std::string nextToken();
     std::string getConvertedString();
 
+    // column (counting from 1) of the token last returned by nextToken(), 0 past the end of the line
+    size_t lastColumn();
+
 private:
 
     std::queue<std::string> tokenQueue;
+    std::queue<size_t> columnQueue;
+    size_t column;
     std::string convertedString;
 };
 
@@ -1,48 +1,191 @@
-//#include "assembler.h"
 #include "asm.h"
-#include "opcode.h"
+#include "conditional.h"
+#include "diagnostics.h"
+#include "parallel.h"
+#include "stream.h"
+#include "symfile.h"
+#include "variables.h"
 
 #include <iostream>
-#include <iomanip>
+#include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-int main(int argc, char *argv[]) { 
-    
-    std::vector<std::string> program = {
-        "begin:",
-        "ldx #$00",
-        "stx $d020",
-        "stx $d021",
-        "rts"
-    };
+#include <cstdlib>
 
-    setOutFile("HELLO.PRG");
-    setProgramStart(0xc000);
+// files shorter than this assemble faster on a single thread than they can be split up
+static const size_t PARALLEL_THRESHOLD = 65536;
 
-    for (std::string line : program) {
-        assemble(line);
+void usage() {
+    std::cerr << "usage: 6502-as [-j jobs] [--org address] [--stream] [--dump-symbols] [--stats]" << std::endl
+              << "               [--max-errors n] [--diagnostics-format text|json] [-I dir] [-MD] [-MF depfile]" << std::endl
+              << "               [-D name[=value]] [--compress] [--sfx address]" << std::endl
+              << "               [--symbols symfile] [--emit-symbols symfile]" << std::endl
+              << "               [-o outfile] infile" << std::endl
+              << "  infile may be - to read the program from standard input" << std::endl;
+}
+
+// -MD names the dependency file after the output file, like the C compilers do
+std::string dependencyFileFor(std::string outfile) {
+    size_t slash = outfile.rfind('/'), dot = outfile.rfind('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) outfile = outfile.substr(0, dot);
+    return outfile + ".d";
+}
+
+int main(int argc, char *argv[]) {
+    std::string infile, outfile = "a.prg", depfile, emitSymbols;
+    uint16_t org = 0xc000;
+    unsigned jobs = std::thread::hardware_concurrency();
+    uint16_t sfx = 0;
+    bool dumpSymbols = false, stream = false, writeDeps = false, stats = false, compress = false, selfExtract = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            outfile = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            jobs = (unsigned) std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--org" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value[0] == '$') value = value.substr(1);
+            org = (uint16_t) std::strtoul(value.c_str(), nullptr, 16);
+        } else if (arg == "--sfx" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value[0] == '$') value = value.substr(1);
+            sfx = (uint16_t) std::strtoul(value.c_str(), nullptr, 16);
+            selfExtract = true;
+        } else if (arg == "--symbols" && i + 1 < argc) {
+            std::string msg = loadSymbolFile(argv[++i]);
+            if (!msg.empty()) {
+                std::cerr << msg << std::endl;
+                return 1;
+            }
+        } else if (arg == "--emit-symbols" && i + 1 < argc) {
+            emitSymbols = argv[++i];
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--max-errors" && i + 1 < argc) {
+            setMaxErrors(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--diagnostics-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format != "text" && format != "json") {
+                usage();
+                return 1;
+            }
+            setDiagnosticFormat((format == "json") ? JsonDiagnostics : TextDiagnostics);
+        } else if (arg == "-I" && i + 1 < argc) {
+            addIncludePath(argv[++i]);
+        } else if (arg.compare(0, 2, "-I") == 0 && arg.size() > 2) {
+            addIncludePath(arg.substr(2));
+        } else if (arg.compare(0, 2, "-D") == 0 && (arg.size() > 2 || i + 1 < argc)) {
+            std::string define = (arg.size() > 2) ? arg.substr(2) : argv[++i];
+            size_t eq = define.find('=');
+            uint32_t value = 1;
+            if (eq != std::string::npos) {
+                if (!parseNumber(define.substr(eq + 1), value)) {
+                    std::cerr << "bad value in -D " << define << std::endl;
+                    return 1;
+                }
+                define = define.substr(0, eq);
+            }
+            defineSymbol(define, (uint16_t) value);
+        } else if (arg == "-MD") {
+            writeDeps = true;
+        } else if (arg == "-MF" && i + 1 < argc) {
+            depfile = argv[++i];
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--dump-symbols") {
+            dumpSymbols = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (infile.empty() && (arg == "-" || arg[0] != '-')) {
+            infile = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (infile.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::string sourceName = (infile == "-") ? "<stdin>" : infile;
+    setDiagnosticSource(sourceName);
+
+    // streaming assembles as the source arrives, everything else wants the whole program up front
+    std::ifstream fin;
+    std::vector<SourceLine> program;
+    if (stream) {
+        if (infile != "-") fin.open(infile);
+        if (infile != "-" && !fin.is_open()) {
+            std::cerr << "could not read " << infile << std::endl;
+            return 1;
+        }
+    } else {
+        const SourceFile *file = (infile == "-") ? readSourceStream(std::cin, sourceName) : loadSourceFile(infile);
+        if (file == nullptr) {
+            std::cerr << "could not read " << infile << std::endl;
+            return 1;
+        }
+
+        expandSource(file, program);
+        allocateVariables(program);
     }
 
-    startNextPass();
+    setOutFile(outfile);
+    setProgramStart(org);
+    setCompression(compress, selfExtract, sfx);
+
+    if (stream) {
+        assembleStream((infile == "-") ? std::cin : fin, sourceName, org);
+    } else if (jobs > 1 && program.size() >= PARALLEL_THRESHOLD) {
+        assembleParallel(program, org, jobs);
+    } else {
+        for (const SourceLine& line : program) {
+            assemble(line);
+        }
 
-    for (std::string line : program) {
-        assemble(line);
+        startNextPass();
+
+        for (const SourceLine& line : program) {
+            assemble(line);
+            if (errorLimitReached()) break;
+        }
     }
 
     // close the assembler context, writes file to disk
     close();
-    dumpSymbolTable();
 
-    /*
-    std::cout << "--- Dumping assembled code ---" << std::endl;
-    std::cout << std::hex;
+    if (writeDeps || !depfile.empty()) {
+        if (depfile.empty()) depfile = dependencyFileFor(outfile);
+        if (!writeDependencyFile(depfile, outfile, (infile == "-") ? "" : infile)) {
+            std::cerr << "could not write " << depfile << std::endl;
+        }
+    }
+
+    // a snapshot of a broken program would only pass its errors on
+    if (!emitSymbols.empty() && isSuccessfulAssembly()) {
+        std::string msg = writeSymbolFile(emitSymbols, getSymbolTable());
+        if (!msg.empty()) std::cerr << msg << std::endl;
+    }
+
+    flushDiagnostics(std::cerr);
+    if (dumpSymbols) {
+        dumpSymbolTable();
+        dumpVariables();
+    }
 
-    for (uint8_t byte : getObjectFile()) {
-        std::cout << "$" << (int) byte << " ";
+    if (stats) {
+        LineCacheStats cache = getLineCacheStats();
+        uint64_t lookups = cache.hits + cache.misses;
+        std::cout << std::dec << "line cache: " << cache.hits << " hits, " << cache.misses << " misses ("
+                  << ((lookups > 0) ? cache.hits * 100 / lookups : 0) << "% hit rate)" << std::endl;
     }
 
-    std::cout << std::endl << "--- End assembly dump ---" << std::endl;
-    */
     std::cout << "Assembly was " << ((isSuccessfulAssembly()) ? "successful" : "not successful") << std::endl;
-}
\ No newline at end of file
+    return isSuccessfulAssembly() ? 0 : 1;
+}
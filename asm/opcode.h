@@ -28,4 +28,46 @@ extern InstructionPacket IllegalInstruction;
 bool matchesOpcode(std::string token);
 InstructionPacket buildInstruction(std::string mnemonic, std::string argument);
 
+/**
+ * parseNumber(): read a decimal, $hex or %binary number of at most 16 bits that makes up all of text
+ * returns: false if text is not such a number
+ */
+bool parseNumber(const std::string& text, uint32_t& value);
+
+/**
+ * LineKey: a source line reduced to what the tokenizer sees - lower case, single spaces, no
+ * comment - and its hash
+ */
+struct LineKey {
+    std::string text;
+    uint64_t hash;
+};
+
+struct LineCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+};
+
+LineKey normalizeLine(const std::string& line);
+
+/**
+ * findCachedLine(): look up the instruction an identical line encoded to earlier.
+ * cacheLine(): remember the instruction for a line. Only label free instructions may be cached.
+ * The cache is kept per thread, so both are safe to call from several threads at once
+ */
+bool findCachedLine(const LineKey& key, InstructionPacket& ip);
+void cacheLine(const LineKey& key, const InstructionPacket& ip);
+
+/**
+ * getLineCacheStats(): lookups made so far by this thread and every thread that has finished
+ */
+LineCacheStats getLineCacheStats();
+
+/**
+ * countLineCacheLookups(): stop or resume counting this thread's lookups. A driver that classifies
+ * the same lines again in a later pass turns counting off, so the stats reflect lines repeated in
+ * the source rather than lines seen twice
+ */
+void countLineCacheLookups(bool count);
+
 #endif
\ No newline at end of file
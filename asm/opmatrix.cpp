@@ -1,7 +1,9 @@
 #include "opcode.h"
 
+#include <atomic>
 #include <regex>
 #include <map>
+#include <vector>
 #include <cstring>
 #include <cctype>
 
@@ -13,6 +15,34 @@ using namespace std;
 extern const Mnemonic opcodeMatrix[16][16];
 extern const string mnemonics[];
 
+// unrolled and generated code repeats the same few hundred lines, a small direct mapped table
+// per thread catches them without any locking
+static const size_t LINE_CACHE_SIZE = 4096;
+
+struct LineCacheEntry {
+    LineKey key;
+    InstructionPacket ip;
+    bool used;
+};
+
+static atomic<uint64_t> finishedHits(0), finishedMisses(0);
+
+struct LineCache {
+    vector<LineCacheEntry> entries;
+    LineCacheStats stats;
+    bool counting;
+
+    LineCache() : entries(LINE_CACHE_SIZE), stats({ 0, 0 }), counting(true) {}
+
+    // fold the counters of a finished thread into the totals
+    ~LineCache() {
+        finishedHits += stats.hits;
+        finishedMisses += stats.misses;
+    }
+};
+
+static thread_local LineCache lineCache;
+
 struct AddressMode {
     string regex;
     int bytes;
@@ -21,12 +51,14 @@ struct AddressMode {
 Mnemonic IllegalMnemonic = { .mnemonic = "", .addrmode = "" };
 InstructionPacket IllegalInstruction = { .opcode = ILLEGAL_OPCODE, .argument = 0, .size = 0, .label = "", .isLabelType = false, .isRelativeJump = false };
 
-// addressing modes and their regex patterns
+// addressing modes and their regex patterns. label operands are names, @local names or
+// runs of + and - naming the nth anonymous label ahead or behind
 static const map<string, AddressMode> addressModes = {
     { "", { "$(?!\\s\\S)$", 1 } },
     { "imm", { "^#\\$([0-9a-f]{1,2})$", 2 } },
     { "zp",  { "^\\$([0-9a-f]{1,2})$", 2 } },
     { "zpx", { "^\\$([0-9a-f]{1,2}),x$", 2 } },
+    { "zpy", { "^\\$([0-9a-f]{1,2}),y$", 2 } },
     { "abs", { "^\\$([0-9a-f]{3,4})$", 3 } },
     { "abx", { "^\\$([0-9a-f]{3,4}),x$", 3 } },
     { "aby", { "^\\$([0-9a-f]{3,4}),y$", 3 } },
@@ -34,11 +66,22 @@ static const map<string, AddressMode> addressModes = {
     { "izy", { "^\\(\\$([0-9a-f]{1,2})\\),y$", 2 } },
     { "ind", { "^\\(\\$([0-9a-f]{3,4})\\)$", 3 } },
     { "rel", { "^\\(\\$([0-9a-f]{1,2})\\)$", 2 } },
-    { "label-abs", { "^[0-9a-zA-Z_]*$", 3 } },
-    { "label-ind", { "^\\(([0-9a-zA-Z_]*)\\)$", 3} },
-    { "label-rel", { "^[0-9a-zA-Z_]*$", 2 } }
+    { "label-abs", { "^(@?[0-9a-zA-Z_]*|\\++|-+)$", 3 } },
+    { "label-ind", { "^\\((@?[0-9a-zA-Z_]*|\\++|-+)\\)$", 3} },
+    { "label-rel", { "^(@?[0-9a-zA-Z_]*|\\++|-+)$", 2 } }
 };
 
+// addressing mode patterns are matched against every operand, so they are only compiled once
+static const regex& modeRegex(const string& addrmode) {
+    static const map<string, regex> compiled = [] {
+        map<string, regex> m;
+        for (auto& mode : addressModes) m.emplace(mode.first, regex(mode.second.regex));
+        return m;
+    }();
+
+    return compiled.find(addrmode)->second;
+}
+
 string tolower(string s) {
     string d = s;
     for (size_t i = 0; i < d.length(); i++) {
@@ -47,6 +90,29 @@ string tolower(string s) {
     return d;
 }
 
+// see API note in opcode.h
+bool parseNumber(const string& text, uint32_t& value) {
+    uint32_t base = 10;
+    if (!text.empty() && text[0] == '$') base = 16;
+    if (!text.empty() && text[0] == '%') base = 2;
+
+    size_t i = (base == 10) ? 0 : 1;
+    if (i >= text.size()) return false;
+
+    uint32_t v = 0;
+    for (; i < text.size(); i++) {
+        unsigned char c = (unsigned char) tolower((unsigned char) text[i]);
+        uint32_t digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : base;
+        if (digit >= base) return false;
+
+        v = v * base + digit;
+        if (v > 0xffff) return false;
+    }
+
+    value = v;
+    return true;
+}
+
 string toupper(string s) {
     string d = s;
     for (size_t i = 0; i < d.length(); i++) {
@@ -57,10 +123,9 @@ string toupper(string s) {
 
 string stripLabel(string label, string addrmode) {
     if (addrmode == "label-abs" || addrmode == "label-rel") return label;
-    regex rgx = regex(addressModes.find(addrmode)->second.regex);
     smatch match;
 
-    if (regex_search(label, match, rgx) == true) {
+    if (regex_search(label, match, modeRegex(addrmode)) == true) {
         return match.str(1);
     }
 
@@ -82,18 +147,24 @@ bool addressModeIsLabelType(string token) {
 }
 
 uint8_t findOpcodeAddress(string mnemonic, string addrmode) {
-    Mnemonic m = { .mnemonic = toupper(mnemonic), .addrmode = addrmode };
-    // search each matrix row
-    for (size_t i = 0; i < 16; i++) {
-        // search each matrix column
-        for (size_t j = 0; j < 16; j++) {
-            if (m == opcodeMatrix[i][j]) {
-                return (i*16)+j;        // the 8 bit opcode is formed by the location in the matrix
+    // reverse index of the matrix, keyed by upper case mnemonic and address mode
+    static const map<pair<string,string>, uint8_t> index = [] {
+        map<pair<string,string>, uint8_t> m;
+        // search each matrix row
+        for (size_t i = 0; i < 16; i++) {
+            // search each matrix column
+            for (size_t j = 0; j < 16; j++) {
+                const Mnemonic& op = opcodeMatrix[i][j];
+                // the 8 bit opcode is formed by the location in the matrix. keep the first match,
+                // like the old linear search did
+                m.emplace(make_pair(toupper(op.mnemonic), tolower(op.addrmode)), (uint8_t) ((i*16)+j));
             }
         }
-    }
+        return m;
+    }();
 
-    return ILLEGAL_OPCODE;
+    auto it = index.find(make_pair(toupper(mnemonic), tolower(addrmode)));
+    return (it != index.end()) ? it->second : ILLEGAL_OPCODE;
 }
 
 InstructionPacket createInstructionPacket(uint8_t opcode, string argument, string addrmode) {
@@ -102,6 +173,7 @@ InstructionPacket createInstructionPacket(uint8_t opcode, string argument, strin
     ip.opcode = opcode;
     ip.size = mode.bytes;
     ip.argument = 0;
+    ip.isLabelType = false;
     ip.isRelativeJump = false;
     
     if (addrmode == "label-rel" || addrmode == "rel") ip.isRelativeJump = true;
@@ -111,7 +183,7 @@ InstructionPacket createInstructionPacket(uint8_t opcode, string argument, strin
         ip.label = stripLabel(argument, addrmode);
     } else if (!addrmode.empty()) {
         smatch match;
-        if (regex_search(argument, match, regex(mode.regex)) == true) {
+        if (regex_search(argument, match, modeRegex(addrmode)) == true) {
             ip.argument = stoi(match.str(1), 0, 16);
         }
     }
@@ -122,8 +194,7 @@ InstructionPacket createInstructionPacket(uint8_t opcode, string argument, strin
 InstructionPacket buildInstruction(string mnemonic, string argument) {
     map<string,AddressMode>::const_iterator it = addressModes.begin();
     while (it != addressModes.end()) {
-        regex rgx = regex(it->second.regex);
-        if (regex_match(argument, rgx) == true) {
+        if (regex_match(argument, modeRegex(it->first)) == true) {
             string addrmode = it->first;
 
             string real_addrmode = addrmode;
@@ -148,4 +219,58 @@ bool Mnemonic::operator==(const Mnemonic& opcode) {
 bool InstructionPacket::operator==(const InstructionPacket& packet) {
     return (opcode == packet.opcode && argument == packet.argument &&
         size == packet.size && label == packet.label && isLabelType == packet.isLabelType);
-}
\ No newline at end of file
+}
+
+// see API note in opcode.h
+LineKey normalizeLine(const string& line) {
+    LineKey key = { "", 14695981039346656037ull };
+    key.text.reserve(line.size());
+
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && isspace((unsigned char) line[i])) i++;
+        if (i >= line.size() || line[i] == ';') break;
+
+        if (!key.text.empty()) key.text += ' ';
+        while (i < line.size() && !isspace((unsigned char) line[i])) key.text += (char) tolower((unsigned char) line[i++]);
+    }
+
+    // FNV-1a
+    for (char c : key.text) {
+        key.hash ^= (uint8_t) c;
+        key.hash *= 1099511628211ull;
+    }
+
+    return key;
+}
+
+// see API note in opcode.h
+bool findCachedLine(const LineKey& key, InstructionPacket& ip) {
+    const LineCacheEntry& entry = lineCache.entries[key.hash % LINE_CACHE_SIZE];
+    if (entry.used && entry.key.hash == key.hash && entry.key.text == key.text) {
+        if (lineCache.counting) lineCache.stats.hits++;
+        ip = entry.ip;
+        return true;
+    }
+
+    if (lineCache.counting) lineCache.stats.misses++;
+    return false;
+}
+
+// see API note in opcode.h
+void cacheLine(const LineKey& key, const InstructionPacket& ip) {
+    LineCacheEntry& entry = lineCache.entries[key.hash % LINE_CACHE_SIZE];
+    entry.key = key;
+    entry.ip = ip;
+    entry.used = true;
+}
+
+// see API note in opcode.h
+void countLineCacheLookups(bool count) {
+    lineCache.counting = count;
+}
+
+// see API note in opcode.h
+LineCacheStats getLineCacheStats() {
+    return { finishedHits + lineCache.stats.hits, finishedMisses + lineCache.stats.misses };
+}
@@ -0,0 +1,202 @@
+#include "parallel.h"
+#include "asm.h"
+#include "diagnostics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+using namespace std;
+
+// smaller chunks cost more in bookkeeping than they win back in parallelism
+static const size_t MIN_CHUNK_LINES = 4096;
+
+// an address inside a chunk. until the chunk has seen an .org, addresses are relative to its base
+struct ChunkAddress {
+    uint32_t value;
+    bool absolute;
+};
+
+struct Chunk {
+    size_t first, last;                             // source lines [first, last)
+    vector<LineRecord> records;
+    vector<pair<size_t, ChunkAddress>> labels;     // records that define labels or touch the scope
+    vector<pair<ChunkAddress, uint32_t>> segments;  // start and length of every run of bytes between .orgs
+    vector<tuple<size_t, size_t, string>> errors;   // program index, column and message, reported after encoding
+    bool failed;                                    // errors past the limit are not stored, but still fail
+    ChunkAddress end;                               // address following the chunk
+    uint32_t base;                                  // address the chunk starts at
+};
+
+/**
+ * run fn(i) for every i in [0, count), handing indices out to jobs threads as they free up
+ */
+static void parallelFor(size_t count, unsigned jobs, const function<void(size_t)>& fn) {
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) fn(i);
+    };
+
+    vector<thread> threads;
+    for (unsigned j = 1; j < jobs && j < count; j++) threads.emplace_back(worker);
+    worker();
+
+    for (thread& t : threads) t.join();
+}
+
+static uint32_t resolveAddress(ChunkAddress address, uint32_t base) {
+    return address.absolute ? address.value : base + address.value;
+}
+
+/**
+ * true if segments of two different chunks write to the same addresses. chunks are only encoded
+ * in parallel when they cannot collide, so the ownership checks in the image never race
+ */
+static bool chunksOverlap(const vector<Chunk>& chunks) {
+    vector<tuple<uint32_t, uint32_t, size_t>> segments;         // start, end, chunk
+    for (size_t c = 0; c < chunks.size(); c++) {
+        for (auto& segment : chunks[c].segments) {
+            uint32_t start = resolveAddress(segment.first, chunks[c].base);
+            segments.push_back(make_tuple(start, start + segment.second, c));
+        }
+    }
+
+    sort(segments.begin(), segments.end());
+    uint32_t reach = 0;
+    size_t reachChunk = 0;
+    for (auto& segment : segments) {
+        if (get<0>(segment) < reach && get<2>(segment) != reachChunk) return true;
+        if (get<1>(segment) > reach) {
+            reach = get<1>(segment);
+            reachChunk = get<2>(segment);
+        }
+    }
+
+    return false;
+}
+
+// see API note in parallel.h
+bool assembleParallel(const vector<SourceLine>& program, uint16_t origin, unsigned jobs) {
+    if (jobs == 0) jobs = 1;
+
+    // a few chunks per thread keeps the threads busy when chunk costs are uneven
+    size_t chunkLines = max(MIN_CHUNK_LINES, program.size() / (jobs * 4) + 1);
+    vector<Chunk> chunks;
+    for (size_t first = 0; first < program.size(); first += chunkLines) {
+        Chunk chunk;
+        chunk.first = first;
+        chunk.last = min(first + chunkLines, program.size());
+        chunk.end = { 0, false };
+        chunk.failed = false;
+        chunk.base = 0;
+        chunks.push_back(chunk);
+    }
+
+    // classify and size every chunk, collecting its labels and segments
+    parallelFor(chunks.size(), jobs, [&](size_t c) {
+        Chunk& chunk = chunks[c];
+        chunk.records.reserve(chunk.last - chunk.first);
+
+        ChunkAddress pc = { 0, false }, segmentStart = pc;
+        for (size_t i = chunk.first; i < chunk.last; i++) {
+            LineRecord rec = classifyLine(string(program[i].text()));
+
+            if (rec.setsOrigin) {
+                if (pc.value != segmentStart.value) chunk.segments.push_back(make_pair(segmentStart, pc.value - segmentStart.value));
+                pc = segmentStart = { rec.newOrigin, true };
+            }
+
+            if (needsScope(rec)) chunk.labels.push_back(make_pair(i - chunk.first, pc));
+            pc.value += recordSize(rec);
+            chunk.records.push_back(rec);
+        }
+
+        if (pc.value != segmentStart.value) chunk.segments.push_back(make_pair(segmentStart, pc.value - segmentStart.value));
+        chunk.end = pc;
+    });
+
+    // prefix scan over the chunks: a chunk starts where the previous one ended, which is either an
+    // absolute address (the chunk contained an .org) or the previous base plus its size. the per-line
+    // addresses inside each chunk were already summed in parallel above
+    uint32_t address = origin;
+    for (Chunk& chunk : chunks) {
+        chunk.base = address;
+        address = resolveAddress(chunk.end, chunk.base);
+    }
+
+    // the only serial step: build the symbol table from the per-chunk label lists. the label scope
+    // runs across chunk boundaries, so @local labels are qualified here as well
+    LabelScope scope = { "", 0 };
+    for (Chunk& chunk : chunks) {
+        for (auto& label : chunk.labels) {
+            LineRecord& rec = chunk.records[label.first];
+            enterScope(scope, rec);
+            if (!rec.label.empty() && !defineLabel(rec.label, (uint16_t) resolveAddress(label.second, chunk.base), chunk.first + label.first)) {
+                const SourceLine& line = program[chunk.first + label.first];
+                reportDiagnostic(SeverityWarning, line.file->path, line.line, 0, "Label redefinition");
+            }
+        }
+    }
+    finishLabels();
+
+    // encode every chunk straight into its place in the shared image
+    parallelFor(chunks.size(), chunksOverlap(chunks) ? 1 : jobs, [&](size_t c) {
+        Chunk& chunk = chunks[c];
+        uint32_t pc = chunk.base;
+
+        // each chunk's errors are in source order, so once a chunk holds as many as can be reported
+        // nothing later in it will be
+        auto addError = [&](size_t line, size_t column, const string& msg) {
+            chunk.failed = true;
+            if (!holdsEnoughErrors(chunk.errors.size())) chunk.errors.push_back(make_tuple(line, column, msg));
+        };
+
+        for (size_t i = 0; i < chunk.records.size(); i++) {
+            LineRecord& rec = chunk.records[i];
+            size_t line = chunk.first + i;
+            ByteOwner owner = { &program[line].file->path, program[line].line };
+
+            if (rec.setsOrigin) pc = rec.newOrigin;
+
+            if (!rec.error.empty()) {
+                addError(line, rec.errorColumn, rec.error);
+            } else if (rec.hasInstruction) {
+                if (rec.ip.isLabelType) {
+                    string msg = resolveLabel(rec.ip, (uint16_t) pc, line);
+                    if (!msg.empty()) addError(line, rec.operandColumn, msg);
+                }
+
+                uint8_t bytes[3];
+                int size = encodeInstruction(rec.ip, bytes);
+                string msg = emitBytes(pc, bytes, size, owner);
+                if (!msg.empty()) addError(line, 0, msg);
+                pc += size;
+            } else if (!rec.data.empty()) {
+                string msg = emitBytes(pc, rec.data.data(), rec.data.size(), owner);
+                if (!msg.empty()) addError(line, 0, msg);
+                pc += rec.data.size();
+            }
+        }
+
+        // the records are not needed any more, give the memory back early on big inputs
+        vector<LineRecord>().swap(chunk.records);
+    });
+
+    // report in source order, stopping once the error limit is hit
+    bool success = true;
+    for (Chunk& chunk : chunks) {
+        if (chunk.failed) success = false;
+        for (auto& err : chunk.errors) {
+            if (errorLimitReached()) return false;
+
+            const SourceLine& line = program[get<0>(err)];
+            reportDiagnostic(SeverityError, line.file->path, line.line, get<1>(err), get<2>(err));
+            success = false;
+        }
+    }
+
+    return success;
+}
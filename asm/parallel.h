@@ -0,0 +1,22 @@
+#ifndef _6502_PARALLEL_H
+#define _6502_PARALLEL_H
+
+#include "source.h"
+
+#include <vector>
+
+#include <cstdint>
+
+/**
+ * assembleParallel(): assemble a whole program using up to jobs threads
+ * inputs: program - the source lines with includes expanded, origin - the starting address, jobs - number of worker threads
+ * returns: true if the program assembled without errors
+ *
+ * The program is split into chunks of lines. Every chunk is classified and sized on its own thread,
+ * a prefix scan over the chunk sizes (and .org directives) gives each chunk its base address, and the
+ * chunks are then encoded straight into their place in the program image (see getProgramImage()).
+ * Building the symbol table from the per-chunk label lists is the only serial step.
+ */
+bool assembleParallel(const std::vector<SourceLine>& program, uint16_t origin, unsigned jobs);
+
+#endif
@@ -0,0 +1,221 @@
+#include "source.h"
+#include "ltokenizer.h"
+#include "diagnostics.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static map<string, unique_ptr<SourceFile>> fileCache;     // keyed by canonical path
+static vector<const SourceFile *> filesRead;               // in load order, for dependency output
+static vector<unique_ptr<SourceFile>> streams;
+static vector<string> includePaths;
+static mutex cacheMutex;
+
+/**
+ * split a buffer into lines the way getline() would: a trailing newline does not start another line
+ */
+static void splitLines(const char *data, size_t size, vector<string_view>& lines) {
+    size_t start = 0;
+    while (start < size) {
+        const char *nl = (const char *) memchr(data + start, '\n', size - start);
+        size_t end = (nl == nullptr) ? size : (size_t) (nl - data);
+        lines.emplace_back(data + start, end - start);
+        start = end + 1;
+    }
+}
+
+static bool mapLines(const string& path, vector<string_view>& lines) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    // the mapping is never taken down, the lines point into it for the rest of the process
+    if (st.st_size > 0) {
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        splitLines((const char *) data, st.st_size, lines);
+    }
+
+    ::close(fd);
+    return true;
+}
+
+static string canonicalPath(const string& path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) != nullptr) return resolved;
+    return path;
+}
+
+// see API note in source.h
+const SourceFile *loadSourceFile(string path) {
+    lock_guard<mutex> lock(cacheMutex);
+
+    string key = canonicalPath(path);
+    auto it = fileCache.find(key);
+    if (it != fileCache.end()) return it->second.get();
+
+    unique_ptr<SourceFile> file(new SourceFile());
+    file->path = path;
+    if (!mapLines(path, file->lines)) return nullptr;
+
+    const SourceFile *loaded = file.get();
+    fileCache[key] = move(file);
+    filesRead.push_back(loaded);
+    return loaded;
+}
+
+// see API note in source.h
+const SourceFile *readSourceStream(istream& in, string name) {
+    unique_ptr<SourceFile> file(new SourceFile());
+    file->path = name;
+
+    file->text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    if (in.bad()) return nullptr;
+    splitLines(file->text.data(), file->text.size(), file->lines);
+
+    lock_guard<mutex> lock(cacheMutex);
+    streams.push_back(move(file));
+    return streams.back().get();
+}
+
+void addIncludePath(string dir) {
+    includePaths.push_back(dir);
+}
+
+// see API note in source.h
+bool matchesInclude(string_view line, string& name) {
+    // cheap check first, almost every line is turned away here
+    size_t i = line.find_first_not_of(" \t");
+    if (i == string_view::npos || line[i] != '.') return false;
+
+    LineTokenizer lt{string(line)};
+    if (lt.nextToken() != ".include") return false;
+
+    string token = lt.nextToken();
+    name = "";
+    if (token.size() > 2 && token[0] == '"' && token[token.size() - 1] == '"') {
+        name = token.substr(1, token.size() - 2);
+    }
+
+    return true;
+}
+
+// see API note in source.h
+const SourceFile *findInclude(string name, const string& fromPath) {
+    if (name[0] == '/') return loadSourceFile(name);
+
+    // next to the including file first, then the include paths in the order they were given
+    vector<string> candidates;
+    size_t slash = fromPath.rfind('/');
+    if (slash != string::npos) candidates.push_back(fromPath.substr(0, slash + 1) + name);
+    else candidates.push_back(name);
+
+    for (const string& dir : includePaths) candidates.push_back(dir + "/" + name);
+
+    for (const string& candidate : candidates) {
+        const SourceFile *file = loadSourceFile(candidate);
+        if (file != nullptr) return file;
+    }
+
+    return nullptr;
+}
+
+static bool expand(const SourceFile *file, vector<SourceLine>& program, vector<const SourceFile *>& stack, ConditionalState& conditions) {
+    bool ok = true;
+    stack.push_back(file);
+
+    for (size_t i = 0; i < file->lines.size(); i++) {
+        if (conditions.consumeLine(file->lines[i], file->path, i + 1)) continue;
+
+        string name;
+        if (!matchesInclude(file->lines[i], name)) {
+            program.push_back({ file, i + 1 });
+            continue;
+        }
+
+        if (name.empty()) {
+            reportDiagnostic(SeverityError, file->path, i + 1, 0, "Expected quoted file name after .include");
+            ok = false;
+            continue;
+        }
+
+        const SourceFile *included = findInclude(name, file->path);
+        if (included == nullptr) {
+            reportDiagnostic(SeverityError, file->path, i + 1, 0, "Cannot open include file " + name);
+            ok = false;
+        } else if (find(stack.begin(), stack.end(), included) != stack.end()) {
+            reportDiagnostic(SeverityError, file->path, i + 1, 0, "Recursive include of " + name);
+            ok = false;
+        } else {
+            ok = expand(included, program, stack, conditions) && ok;
+        }
+    }
+
+    stack.pop_back();
+    return ok;
+}
+
+// see API note in source.h
+bool expandSource(const SourceFile *file, vector<SourceLine>& program, ConditionalState *conditions) {
+    vector<const SourceFile *> stack;
+    if (conditions != nullptr) return expand(file, program, stack, *conditions);
+
+    ConditionalState state;
+    bool ok = expand(file, program, stack, state);
+    state.finish();
+    return ok;
+}
+
+static string escapeMakePath(const string& path) {
+    string out;
+    for (char c : path) {
+        if (c == ' ' || c == '#') out += '\\';
+        if (c == '$') out += '$';
+        out += c;
+    }
+    return out;
+}
+
+// see API note in source.h
+bool writeDependencyFile(string depfile, string target, string source) {
+    ofstream out(depfile, fstream::out | fstream::trunc);
+    if (!out.is_open()) return false;
+
+    lock_guard<mutex> lock(cacheMutex);
+    vector<string> headers;
+    for (const SourceFile *file : filesRead) {
+        if (file->path != source) headers.push_back(file->path);
+    }
+
+    out << escapeMakePath(target) << ":";
+    if (!source.empty()) out << " " << escapeMakePath(source);
+    for (const string& header : headers) out << " \\\n  " << escapeMakePath(header);
+    out << "\n";
+
+    for (const string& header : headers) out << "\n" << escapeMakePath(header) << ":\n";
+
+    return out.good();
+}
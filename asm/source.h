@@ -0,0 +1,83 @@
+#ifndef _6502_SOURCE_H
+#define _6502_SOURCE_H
+
+#include "conditional.h"
+
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+
+/**
+ * SourceFile: the lines of one source file. Files are read through loadSourceFile(), which keeps
+ * every file it has read for the rest of the process, so a header included by many modules is
+ * only read and split into lines once. The lines point straight into the file's mapping, which
+ * stays for the rest of the process too, or into text for sources that were not mapped
+ */
+struct SourceFile {
+    std::string path;
+    std::vector<std::string_view> lines;
+    std::string text;
+};
+
+/**
+ * SourceLine: one line of the program after includes have been expanded
+ */
+struct SourceLine {
+    const SourceFile *file;
+    size_t line;                // counting from 1
+    const std::string *rewritten = nullptr;     // replaces the file's text, see allocateVariables()
+
+    std::string_view text() const { return rewritten ? std::string_view(*rewritten) : file->lines[line - 1]; }
+};
+
+/**
+ * loadSourceFile(): mmap a file and split it into lines, or return the cached copy if it was loaded
+ * before. returns nullptr if the file cannot be read
+ */
+const SourceFile *loadSourceFile(std::string path);
+
+/**
+ * readSourceStream(): read a whole stream (e.g. stdin) into a source file named name
+ */
+const SourceFile *readSourceStream(std::istream& in, std::string name);
+
+/**
+ * addIncludePath(): directory searched for .include files that are not found next to the
+ * including file
+ */
+void addIncludePath(std::string dir);
+
+/**
+ * matchesInclude(): check a line for an .include "file" directive
+ * outputs: name - the quoted file name
+ * returns: true if the line is an .include directive. name is empty if the directive is malformed
+ */
+bool matchesInclude(std::string_view line, std::string& name);
+
+/**
+ * findInclude(): resolve and load a file named by an .include directive in the file at fromPath
+ */
+const SourceFile *findInclude(std::string name, const std::string& fromPath);
+
+/**
+ * expandSource(): append the lines of file to program, replacing .include directives with the
+ * lines of the included files. Conditional assembly is decided here too: blocks that are switched
+ * off (and the conditional directives themselves) never make it into the program, so neither pass
+ * has to look at them again. Problems are reported as diagnostics
+ * inputs: conditions - state to continue from when expanding part of a larger program, or nullptr
+ * to expand a whole program
+ * returns: true if every include could be expanded
+ */
+bool expandSource(const SourceFile *file, std::vector<SourceLine>& program, ConditionalState *conditions = nullptr);
+
+/**
+ * writeDependencyFile(): write a make rule naming the main source and every file read from disk as
+ * prerequisites of target, with an empty rule per included file so deleted headers do not break the build
+ * inputs: source - the main source file, empty if it was not read from disk
+ */
+bool writeDependencyFile(std::string depfile, std::string target, std::string source);
+
+#endif
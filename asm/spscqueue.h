@@ -0,0 +1,60 @@
+#ifndef _6502_SPSCQUEUE_H
+#define _6502_SPSCQUEUE_H
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+#include <cstddef>
+
+/**
+ * SpscQueue: bounded lock-free ring buffer connecting exactly one producer thread to exactly one
+ * consumer thread. push() and pop() spin (yielding the cpu) while the queue is full or empty, which
+ * is what keeps the memory use of a pipeline bounded. Capacity must be a power of two
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+
+    SpscQueue() : head(0), tail(0) {}
+
+    bool tryPush(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+
+        slots[t & (Capacity - 1)] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+
+        item = std::move(slots[h & (Capacity - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(T item) {
+        while (!tryPush(item)) std::this_thread::yield();
+    }
+
+    T pop() {
+        T item;
+        while (!tryPop(item)) std::this_thread::yield();
+        return item;
+    }
+
+private:
+
+    T slots[Capacity];
+
+    // producer and consumer indices live on separate cache lines so the threads do not fight over them
+    alignas(64) std::atomic<size_t> head;       // next slot to read, written by the consumer only
+    alignas(64) std::atomic<size_t> tail;       // next slot to write, written by the producer only
+};
+
+#endif
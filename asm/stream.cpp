@@ -0,0 +1,270 @@
+#include "stream.h"
+#include "spscqueue.h"
+#include "asm.h"
+#include "diagnostics.h"
+#include "source.h"
+#include "symfile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// lines per batch and batches per queue bound the memory held by the pipeline
+static const size_t BATCH_LINES = 1024;
+static const size_t QUEUE_BATCHES = 16;
+
+// where a streamed line came from. seq counts lines in program order, across includes
+struct LineLocation {
+    const string *file;
+    size_t line;
+    size_t seq;
+};
+
+struct SourceBatch {
+    vector<string> lines;
+    vector<LineLocation> locations;
+    bool last;
+};
+
+struct RecordBatch {
+    vector<LineRecord> records;
+    vector<LineLocation> locations;
+    bool last;
+};
+
+// bytes for one line and where they go
+struct OutputRun {
+    uint32_t address;
+    size_t offset, size;        // slice of the batch's bytes
+    LineLocation location;
+};
+
+struct OutputBatch {
+    vector<uint8_t> bytes;
+    vector<OutputRun> runs;
+    bool last;
+};
+
+// a label reference that could not be resolved when its instruction was encoded
+struct Fixup {
+    uint32_t pc;
+    LineLocation location;
+    size_t column;
+    InstructionPacket ip;
+};
+
+// an instruction that took its label from a snapshot. only what it takes to encode it again is
+// kept, in case a later line of the program defines the label
+struct SnapshotUse {
+    uint32_t pc;
+    LineLocation location;
+    size_t column;
+    uint8_t opcode;
+    int size;
+    bool isRelativeJump;
+};
+
+struct StreamError {
+    LineLocation location;
+    size_t column;
+    string message;
+
+    bool operator<(const StreamError& other) const { return location.seq < other.location.seq; }
+};
+
+// see API note in stream.h
+bool assembleStream(istream& in, const string& name, uint16_t origin) {
+    SpscQueue<SourceBatch, QUEUE_BATCHES> sourceQueue;
+    SpscQueue<RecordBatch, QUEUE_BATCHES> recordQueue;
+    SpscQueue<OutputBatch, QUEUE_BATCHES> outputQueue;
+
+    vector<Fixup> fixups;
+    unordered_map<string, vector<SnapshotUse>> snapshotUses;       // by label
+    vector<StreamError> errors, writeErrors;
+    atomic<bool> failed(false);                     // set by the encoder and this thread
+
+    // every list of errors is built in source order, so a list that holds as many errors as can be
+    // reported stops growing. a file full of errors keeps the pipeline's memory bounded
+    auto addError = [&failed](vector<StreamError>& list, const StreamError& err) {
+        failed = true;
+        if (!holdsEnoughErrors(list.size())) list.push_back(err);
+    };
+
+    // stage 1: read lines in batches, dropping switched off conditional blocks and expanding
+    // includes from the source cache
+    thread reader([&]() {
+        SourceBatch batch = { vector<string>(), vector<LineLocation>(), false };
+        ConditionalState conditions;
+        size_t lineNo = 0, seq = 0;
+        string line, include;
+
+        auto emit = [&](string_view text, const string *file, size_t lineInFile) {
+            batch.lines.emplace_back(text);
+            batch.locations.push_back({ file, lineInFile, seq++ });
+            if (batch.lines.size() == BATCH_LINES) {
+                sourceQueue.push(move(batch));
+                batch = { vector<string>(), vector<LineLocation>(), false };
+            }
+        };
+
+        while (getline(in, line)) {
+            lineNo++;
+            if (conditions.consumeLine(line, name, lineNo)) continue;
+
+            if (!matchesInclude(line, include)) {
+                emit(line, &name, lineNo);
+                continue;
+            }
+
+            const SourceFile *file = include.empty() ? nullptr : findInclude(include, name);
+            if (file == nullptr) {
+                reportDiagnostic(SeverityError, name, lineNo, 0, include.empty() ?
+                    "Expected quoted file name after .include" : "Cannot open include file " + include);
+                continue;
+            }
+
+            vector<SourceLine> expanded;
+            expandSource(file, expanded, &conditions);
+            for (const SourceLine& sl : expanded) emit(sl.text(), &sl.file->path, sl.line);
+        }
+
+        conditions.finish();
+        batch.last = true;
+        sourceQueue.push(move(batch));
+    });
+
+    // stage 2: tokenize and classify
+    thread tokenizer([&]() {
+        bool last = false;
+        while (!last) {
+            SourceBatch source = sourceQueue.pop();
+            RecordBatch batch = { vector<LineRecord>(), move(source.locations), source.last };
+            batch.records.reserve(source.lines.size());
+            for (const string& line : source.lines) batch.records.push_back(classifyLine(line));
+
+            last = batch.last;
+            recordQueue.push(move(batch));
+        }
+    });
+
+    // stage 3: assign addresses, define labels and encode. labels that are not known yet
+    // get a placeholder and a fixup
+    thread encoder([&]() {
+        uint32_t pc = origin;
+        LabelScope scope = { "", 0 };
+        bool last = false;
+
+        while (!last) {
+            RecordBatch records = recordQueue.pop();
+            OutputBatch batch = { vector<uint8_t>(), vector<OutputRun>(), records.last };
+            batch.bytes.reserve(records.records.size() * 3);
+
+            for (size_t i = 0; i < records.records.size(); i++) {
+                LineRecord& rec = records.records[i];
+                const LineLocation& location = records.locations[i];
+
+                if (rec.setsOrigin) pc = rec.newOrigin;
+                if (needsScope(rec)) enterScope(scope, rec);
+                if (!rec.label.empty() && !defineLabel(rec.label, (uint16_t) pc, location.seq)) {
+                    reportDiagnostic(SeverityWarning, *location.file, location.line, 0, "Label redefinition");
+                }
+
+                if (!rec.error.empty()) {
+                    addError(errors, { location, rec.errorColumn, rec.error });
+                } else if (rec.hasInstruction) {
+                    if (rec.ip.isLabelType) {
+                        InstructionPacket resolved = rec.ip;
+                        uint16_t address;
+                        if (resolveLabel(resolved, (uint16_t) pc, location.seq, false).empty()) {
+                            rec.ip = resolved;
+                        } else if (getSymbolTable().count(rec.ip.label) == 0 && findSnapshotSymbol(rec.ip.label, address) &&
+                                   setLabelArgument(resolved, (uint16_t) pc, address).empty()) {
+                            snapshotUses[rec.ip.label].push_back({ pc, location, rec.operandColumn, rec.ip.opcode,
+                                                                   rec.ip.size, rec.ip.isRelativeJump });
+                            rec.ip = resolved;
+                        } else {
+                            fixups.push_back({ pc, location, rec.operandColumn, rec.ip });
+                        }
+                    }
+
+                    uint8_t bytes[3];
+                    int size = encodeInstruction(rec.ip, bytes);
+                    batch.runs.push_back({ pc, batch.bytes.size(), (size_t) size, location });
+                    batch.bytes.insert(batch.bytes.end(), bytes, bytes + size);
+                    pc += size;
+                } else if (!rec.data.empty()) {
+                    batch.runs.push_back({ pc, batch.bytes.size(), rec.data.size(), location });
+                    batch.bytes.insert(batch.bytes.end(), rec.data.begin(), rec.data.end());
+                    pc += rec.data.size();
+                }
+            }
+
+            last = batch.last;
+            outputQueue.push(move(batch));
+        }
+    });
+
+    // stage 4: store the encoded bytes in the program image on this thread, and in the output file
+    // as they come
+    setWriteThrough(true);
+    bool last = false;
+    while (!last) {
+        OutputBatch batch = outputQueue.pop();
+        for (const OutputRun& run : batch.runs) {
+            string msg = emitBytes(run.address, batch.bytes.data() + run.offset, run.size, { run.location.file, run.location.line });
+            if (!msg.empty()) addError(writeErrors, { run.location, 0, msg });
+        }
+        last = batch.last;
+    }
+
+    reader.join();
+    tokenizer.join();
+    encoder.join();
+
+    // every label is known now, patch the forward references in place
+    finishLabels();
+    vector<StreamError> fixupErrors;
+    for (Fixup& fixup : fixups) {
+        string msg = resolveLabel(fixup.ip, (uint16_t) fixup.pc, fixup.location.seq);
+        if (!msg.empty()) {
+            addError(fixupErrors, { fixup.location, fixup.column, msg });
+        } else if (fixup.pc + fixup.ip.size <= MemoryImage::SIZE) {
+            uint8_t bytes[3];
+            patchBytes((uint16_t) fixup.pc, bytes, encodeInstruction(fixup.ip, bytes));
+        }
+    }
+
+    // a label the program defined after a snapshot had supplied it wins, encode its uses again
+    for (auto& uses : snapshotUses) {
+        auto label = getSymbolTable().find(uses.first);
+        if (label == getSymbolTable().end()) continue;
+
+        for (SnapshotUse& use : uses.second) {
+            InstructionPacket ip = { use.opcode, 0, use.size, uses.first, true, use.isRelativeJump };
+            string msg = setLabelArgument(ip, (uint16_t) use.pc, label->second);
+            if (!msg.empty()) {
+                addError(fixupErrors, { use.location, use.column, msg });
+            } else if (use.pc + ip.size <= MemoryImage::SIZE) {
+                uint8_t bytes[3];
+                patchBytes((uint16_t) use.pc, bytes, encodeInstruction(ip, bytes));
+            }
+        }
+    }
+
+    // fixup errors come last, put everything back into source order
+    errors.insert(errors.end(), writeErrors.begin(), writeErrors.end());
+    errors.insert(errors.end(), fixupErrors.begin(), fixupErrors.end());
+    stable_sort(errors.begin(), errors.end());
+    for (StreamError& err : errors) {
+        if (errorLimitReached()) break;
+        reportDiagnostic(SeverityError, *err.location.file, err.location.line, err.column, err.message);
+    }
+
+    return !failed;
+}
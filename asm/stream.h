@@ -0,0 +1,24 @@
+#ifndef _6502_STREAM_H
+#define _6502_STREAM_H
+
+#include <istream>
+#include <string>
+
+#include <cstdint>
+
+/**
+ * assembleStream(): assemble a program in a single pass while it is still being read
+ * inputs: in - the program source, name - file name of the source, origin - the load address
+ * returns: true if the program assembled without errors
+ *
+ * Reading, tokenizing, encoding and storing into the program image run as separate pipeline stages on
+ * their own threads, connected by bounded lock-free queues of line batches, so reading overlaps with
+ * assembly and memory use does not grow with the size of the program. The last stage also writes the
+ * bytes to the output file as they come (see setWriteThrough()), so output starts before the input
+ * ends. Included files come from the source cache and are fed into the pipeline in place of their
+ * .include line. Forward label references are stored as placeholders and patched in the image and
+ * the file once the whole program has been seen.
+ */
+bool assembleStream(std::istream& in, const std::string& name, uint16_t origin);
+
+#endif
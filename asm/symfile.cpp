@@ -0,0 +1,180 @@
+#include "symfile.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char MAGIC[8] = { '6', '5', '0', '2', 'S', 'Y', 'M', 0 };
+static const uint32_t VERSION = 1;
+static const uint32_t NO_ENTRY = 0xffffffff;
+
+static const size_t HEADER_SIZE = 36;
+static const size_t BUCKET_SIZE = 4;
+static const size_t ENTRY_SIZE = 16;
+
+// a mapped snapshot, with its header already checked
+struct Snapshot {
+    const uint8_t *data;
+    uint32_t count, bucketCount;
+    uint32_t bucketsOffset, entriesOffset, stringsOffset, stringsSize;
+};
+
+static vector<Snapshot> snapshots;
+
+// FNV-1a
+static uint32_t hashName(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void put16(vector<uint8_t>& out, size_t at, uint32_t value) {
+    out[at] = (uint8_t) value;
+    out[at + 1] = (uint8_t) (value >> 8);
+}
+
+static void put32(vector<uint8_t>& out, size_t at, uint32_t value) {
+    put16(out, at, value & 0xffff);
+    put16(out, at + 2, value >> 16);
+}
+
+static uint32_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+// see API note in symfile.h
+string writeSymbolFile(const string& path, const map<string, uint16_t>& symbols) {
+    uint32_t count = (uint32_t) symbols.size(), bucketCount = 1;
+    while (bucketCount < count) bucketCount <<= 1;
+
+    size_t stringsSize = 0;
+    for (auto& symbol : symbols) stringsSize += symbol.first.size();
+
+    uint32_t bucketsOffset = HEADER_SIZE;
+    uint32_t entriesOffset = bucketsOffset + bucketCount * BUCKET_SIZE;
+    uint32_t stringsOffset = entriesOffset + count * ENTRY_SIZE;
+
+    vector<uint8_t> out(stringsOffset + stringsSize, 0);
+    memcpy(out.data(), MAGIC, sizeof(MAGIC));
+    put32(out, 8, VERSION);
+    put32(out, 12, count);
+    put32(out, 16, bucketCount);
+    put32(out, 20, bucketsOffset);
+    put32(out, 24, entriesOffset);
+    put32(out, 28, stringsOffset);
+    put32(out, 32, (uint32_t) stringsSize);
+
+    for (uint32_t b = 0; b < bucketCount; b++) put32(out, bucketsOffset + b * BUCKET_SIZE, NO_ENTRY);
+
+    // entries are pushed onto the front of their bucket's chain
+    uint32_t index = 0, nameOffset = 0;
+    for (auto& symbol : symbols) {
+        const string& name = symbol.first;
+        uint32_t hash = hashName(name.data(), name.size());
+        size_t bucket = bucketsOffset + (hash & (bucketCount - 1)) * BUCKET_SIZE;
+        size_t entry = entriesOffset + index * ENTRY_SIZE;
+
+        put32(out, entry, nameOffset);
+        put16(out, entry + 4, (uint32_t) name.size());
+        put16(out, entry + 6, symbol.second);
+        put32(out, entry + 8, hash);
+        put32(out, entry + 12, get32(&out[bucket]));
+        put32(out, bucket, index);
+
+        memcpy(&out[stringsOffset + nameOffset], name.data(), name.size());
+        nameOffset += (uint32_t) name.size();
+        index++;
+    }
+
+    ofstream of(path, ios::out | ios::trunc | ios::binary);
+    of.write((const char *) out.data(), out.size());
+    of.close();
+    if (!of) return "could not write " + path;
+
+    return "";
+}
+
+// see API note in symfile.h
+string loadSymbolFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return "could not read " + path;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size < HEADER_SIZE) {
+        ::close(fd);
+        return path + " is not a symbol file";
+    }
+
+    // the mapping stays for the rest of the run, lookups read straight from it
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return "could not read " + path;
+
+    const uint8_t *data = (const uint8_t *) mapped;
+    Snapshot snapshot = { data, get32(data + 12), get32(data + 16), get32(data + 20), get32(data + 24),
+                          get32(data + 28), get32(data + 32) };
+
+    string msg;
+    if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        msg = path + " is not a symbol file";
+    } else if (get32(data + 8) != VERSION) {
+        msg = path + " was written by a different version of the assembler";
+    } else if (snapshot.bucketCount == 0 || (snapshot.bucketCount & (snapshot.bucketCount - 1)) != 0 ||
+               (uint64_t) snapshot.bucketsOffset + (uint64_t) snapshot.bucketCount * BUCKET_SIZE > size ||
+               (uint64_t) snapshot.entriesOffset + (uint64_t) snapshot.count * ENTRY_SIZE > size ||
+               (uint64_t) snapshot.stringsOffset + snapshot.stringsSize > size) {
+        msg = path + " is truncated or damaged";
+    }
+
+    if (!msg.empty()) {
+        munmap(mapped, size);
+        return msg;
+    }
+
+    snapshots.push_back(snapshot);
+    return "";
+}
+
+// see API note in symfile.h
+bool findSnapshotSymbol(const string& name, uint16_t& value) {
+    if (snapshots.empty()) return false;
+
+    uint32_t hash = hashName(name.data(), name.size());
+    for (const Snapshot& snapshot : snapshots) {
+        const uint8_t *bucket = snapshot.data + snapshot.bucketsOffset + (hash & (snapshot.bucketCount - 1)) * BUCKET_SIZE;
+
+        // a damaged chain cannot loop forever, it has at most count links
+        uint32_t index = get32(bucket);
+        for (uint32_t links = 0; index < snapshot.count && links < snapshot.count; links++) {
+            const uint8_t *entry = snapshot.data + snapshot.entriesOffset + index * ENTRY_SIZE;
+            uint32_t nameOffset = get32(entry), length = get16(entry + 4);
+
+            if (get32(entry + 8) == hash && length == name.size() && (uint64_t) nameOffset + length <= snapshot.stringsSize &&
+                memcmp(snapshot.data + snapshot.stringsOffset + nameOffset, name.data(), length) == 0) {
+                value = (uint16_t) get16(entry + 6);
+                return true;
+            }
+
+            index = get32(entry + 12);
+        }
+    }
+
+    return false;
+}
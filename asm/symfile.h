@@ -0,0 +1,40 @@
+#ifndef _6502_SYMFILE_H
+#define _6502_SYMFILE_H
+
+#include <map>
+#include <string>
+
+#include <cstdint>
+
+/**
+ * A symbol snapshot holds the labels of an assembled program so other programs can use them without
+ * assembling the source that defines them. All numbers are little endian and every position is an
+ * offset from the start of the file, so the file is used straight from an mmap:
+ *
+ *   header    magic "6502SYM\0", version, symbol count, bucket count, and the offsets of the tables
+ *   buckets   per hash bucket, the index of its first entry or NO_ENTRY
+ *   entries   name offset and length in the string pool, value, name hash and next entry in the bucket
+ *   strings   the names, not terminated
+ */
+
+/**
+ * writeSymbolFile(): write symbols to a snapshot at path
+ * returns: an error message, or an empty string on success
+ */
+std::string writeSymbolFile(const std::string& path, const std::map<std::string, uint16_t>& symbols);
+
+/**
+ * loadSymbolFile(): map a snapshot and make its symbols visible to findSnapshotSymbol(). Several
+ * snapshots may be loaded, the first one loaded wins if they share a name
+ * returns: an error message, or an empty string on success
+ */
+std::string loadSymbolFile(const std::string& path);
+
+/**
+ * findSnapshotSymbol(): look a name up in the loaded snapshots. Only reads the mappings, so it is safe
+ * to call from several threads once the snapshots are loaded
+ * returns: false if no snapshot defines the name
+ */
+bool findSnapshotSymbol(const std::string& name, uint16_t& value);
+
+#endif
@@ -0,0 +1,375 @@
+#include "variables.h"
+#include "diagnostics.h"
+#include "opcode.h"
+
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cctype>
+#include <cstdio>
+
+using namespace std;
+
+extern string tolower(string s);
+
+// every level of loop nesting makes a reference count this many times more, up to a limit so
+// deep nests do not drown everything else out
+static const uint64_t LOOP_WEIGHT = 8;
+static const size_t MAX_LOOP_DEPTH = 6;
+
+struct Variable {
+    string name;
+    uint32_t size;
+    uint64_t hint;              // weight given in the declaration, 1 if none
+    const string *file;
+    size_t line;
+
+    uint64_t weight;            // weighted references that get cheaper in zero page
+    bool needsZeroPage;         // used through (name),y or (name,x)
+    bool placed;
+    bool zeroPage;
+    uint16_t address;
+};
+
+// free memory declared by .zp and .ram, [start, end)
+struct MemoryRange {
+    uint32_t start, end;
+};
+
+// an operand naming a variable, rewritten once the variable has an address
+struct VariableReference {
+    size_t line;                // index into the program
+    size_t start, end;          // the operand's name and +offset in the line's text
+    size_t variable;
+    uint32_t offset;
+    bool wide;                  // the addressing mode has no zero page form: 4 digits, no weight
+};
+
+struct Word {
+    size_t start, end;
+};
+
+static vector<Variable> variables;
+static deque<string> rewrittenLines;    // SourceLine::rewritten points in here
+
+static void splitWords(string_view line, vector<Word>& words) {
+    words.clear();
+
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && isspace((unsigned char) line[i])) i++;
+        if (i >= line.size() || line[i] == ';') break;
+
+        size_t start = i;
+        while (i < line.size() && !isspace((unsigned char) line[i])) i++;
+        words.push_back({ start, i });
+    }
+}
+
+static string wordText(string_view line, const Word& word) {
+    return tolower(string(line.substr(word.start, word.end - word.start)));
+}
+
+static bool isNameChar(char c) {
+    return (isalnum((unsigned char) c) || c == '_');
+}
+
+/**
+ * the arguments of a declaration, with the spaces after the commas taken out and split on commas
+ */
+static vector<string> declarationArguments(string_view line, const vector<Word>& words) {
+    string list;
+    for (size_t w = 1; w < words.size(); w++) list += wordText(line, words[w]);
+
+    vector<string> arguments;
+    size_t start = 0;
+    while (!list.empty() && start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos) end = list.size();
+        arguments.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+
+    return arguments;
+}
+
+/**
+ * .zp $xx-$xx and .ram $xxxx-$xxxx, both ends inclusive
+ */
+static bool parseRange(const vector<string>& arguments, bool zeroPage, MemoryRange& range) {
+    if (arguments.size() != 1) return false;
+
+    size_t dash = arguments[0].find('-');
+    uint32_t start, end;
+    if (dash == string::npos || !parseNumber(arguments[0].substr(0, dash), start) ||
+        !parseNumber(arguments[0].substr(dash + 1), end) || end < start || (zeroPage && end > 0xff)) {
+        return false;
+    }
+
+    range = { start, end + 1 };
+    return true;
+}
+
+/**
+ * take size bytes from the first range that has room
+ */
+static bool takeMemory(vector<MemoryRange>& ranges, uint32_t size, uint16_t& address) {
+    for (MemoryRange& range : ranges) {
+        if (range.end - range.start >= size) {
+            address = (uint16_t) range.start;
+            range.start += size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool isBackwardJump(const string& mnemonic) {
+    static const char *jumps[] = { "bcc", "bcs", "beq", "bmi", "bne", "bpl", "bvc", "bvs", "jmp" };
+    for (const char *jump : jumps) {
+        if (mnemonic == jump) return true;
+    }
+    return false;
+}
+
+/**
+ * split an operand into a variable name, +offset and addressing mode suffix
+ * returns: false if the operand cannot name a variable
+ */
+static bool parseOperand(const string& operand, size_t& nameStart, size_t& nameEnd, size_t& offsetEnd,
+                         uint32_t& offset, string& suffix) {
+    size_t i = (operand[0] == '(') ? 1 : 0;
+    nameStart = i;
+    while (i < operand.size() && isNameChar(operand[i])) i++;
+    nameEnd = i;
+    if (nameEnd == nameStart) return false;
+
+    offset = 0;
+    if (i < operand.size() && operand[i] == '+') {
+        size_t start = ++i;
+        while (i < operand.size() && operand[i] != ',' && operand[i] != ')') i++;
+        if (!parseNumber(operand.substr(start, i - start), offset)) return false;
+    }
+    offsetEnd = i;
+
+    suffix = operand.substr(i);
+    if (operand[0] == '(') return (suffix == ")" || suffix == ",x)" || suffix == "),y");
+    return (suffix.empty() || suffix == ",x" || suffix == ",y");
+}
+
+// see API note in variables.h
+bool allocateVariables(vector<SourceLine>& program) {
+    vector<MemoryRange> zeroPage, ram;
+    map<string, size_t> variableIndex;
+    vector<bool> declaration(program.size(), false);
+    size_t declarations = 0;
+    vector<Word> words;
+    bool success = true;
+
+    // declarations first: they are directives, so only lines starting with a . need a look
+    for (size_t i = 0; i < program.size(); i++) {
+        string_view text = program[i].text();
+        size_t first = text.find_first_not_of(" \t");
+        if (first == string::npos || text[first] != '.') continue;
+
+        splitWords(text, words);
+        string keyword = wordText(text, words[0]);
+        if (keyword != ".var" && keyword != ".zp" && keyword != ".ram") continue;
+
+        declaration[i] = true;
+        declarations++;
+        const string& file = program[i].file->path;
+        size_t line = program[i].line;
+        vector<string> arguments = declarationArguments(text, words);
+
+        if (keyword != ".var") {
+            MemoryRange range;
+            if (!parseRange(arguments, keyword == ".zp", range)) {
+                reportDiagnostic(SeverityError, file, line, words[0].start + 1, "Illegal memory range");
+                success = false;
+            } else {
+                ((keyword == ".zp") ? zeroPage : ram).push_back(range);
+            }
+            continue;
+        }
+
+        Variable var = { "", 0, 1, &file, line, 0, false, false, false, 0 };
+        bool valid = (arguments.size() == 2 || arguments.size() == 3) && !arguments[0].empty();
+        for (size_t c = 0; valid && c < arguments[0].size(); c++) valid = isNameChar(arguments[0][c]);
+
+        uint32_t hint = 1;
+        if (valid) {
+            var.name = arguments[0];
+            valid = parseNumber(arguments[1], var.size) && var.size > 0 &&
+                    (arguments.size() == 2 || parseNumber(arguments[2], hint));
+            var.hint = hint;
+        }
+
+        if (!valid) {
+            reportDiagnostic(SeverityError, file, line, words[0].start + 1, "Expected .var name, size[, weight]");
+            success = false;
+        } else if (variableIndex.find(var.name) != variableIndex.end()) {
+            reportDiagnostic(SeverityError, file, line, words[0].start + 1, "Variable redefinition");
+            success = false;
+        } else {
+            variableIndex[var.name] = variables.size();
+            variables.push_back(var);
+        }
+    }
+
+    // even malformed declarations have to go, classifyLine() does not know them
+    if (declarations == 0) return success;
+
+    // one pass over the code finds the references and the loops around them. a jump back to an
+    // earlier label closes a loop over every line in between
+    vector<VariableReference> references;
+    vector<long> loopDelta(program.size() + 1, 0);
+    map<string, size_t> labelLines;
+    vector<size_t> anonymousLines;
+    string scope;
+    size_t unnamedScopes = 0;
+
+    for (size_t i = 0; i < program.size() && !variables.empty(); i++) {
+        if (declaration[i]) continue;
+
+        string_view text = program[i].text();
+        splitWords(text, words);
+        if (words.empty()) continue;
+
+        // label, then mnemonic and operand. only three letter words can be mnemonics
+        size_t w = 0;
+        string first = wordText(text, words[0]);
+        if (first == ".local") {
+            scope = "." + to_string(++unnamedScopes);
+            continue;
+        }
+        if (first[0] != '.' && !(first.size() == 3 && matchesOpcode(first))) {
+            string label = (first.back() == ':') ? first.substr(0, first.size() - 1) : first;
+            if (label == "-") anonymousLines.push_back(i);
+            else if (label[0] == '@') labelLines[scope + label] = i;
+            else if (label != "+" && !label.empty()) labelLines[scope = label] = i;
+            w = 1;
+        }
+
+        if (words.size() < w + 2) continue;
+        string mnemonic = wordText(text, words[w]);
+        string operand = wordText(text, words[w + 1]);
+        if (mnemonic.size() != 3 || mnemonic[0] == '.') continue;
+
+        if (isBackwardJump(mnemonic)) {
+            long target = -1;
+            if (operand.find_first_not_of('-') == string::npos) {
+                if (operand.size() <= anonymousLines.size()) target = anonymousLines[anonymousLines.size() - operand.size()];
+            } else {
+                auto it = labelLines.find((operand[0] == '@') ? scope + operand : operand);
+                if (it != labelLines.end()) target = it->second;
+            }
+
+            if (target >= 0) {
+                loopDelta[target]++;
+                loopDelta[i + 1]--;
+            }
+
+            // jmp name and jmp (name) may still name a variable, a branch never does
+            if (mnemonic != "jmp") continue;
+        }
+
+        size_t nameStart, nameEnd, offsetEnd;
+        uint32_t offset;
+        string suffix;
+        if (!parseOperand(operand, nameStart, nameEnd, offsetEnd, offset, suffix)) continue;
+
+        auto it = variableIndex.find(operand.substr(nameStart, nameEnd - nameStart));
+        if (it == variableIndex.end()) continue;
+
+        // jmp, jsr, (name) and name,y only have absolute forms, except for ldx/stx name,y
+        bool wide = (mnemonic == "jmp" || mnemonic == "jsr" || suffix == ")") ||
+                    (suffix == ",y" && mnemonic != "ldx" && mnemonic != "stx");
+        if (suffix == ",x)" || suffix == "),y") variables[it->second].needsZeroPage = true;
+
+        size_t start = words[w + 1].start;
+        references.push_back({ i, start + nameStart, start + offsetEnd, it->second, offset, wide });
+    }
+
+    // loop depth of every line, then the weight of every reference
+    vector<size_t> depth(program.size(), 0);
+    long nesting = 0;
+    for (size_t i = 0; i < program.size(); i++) {
+        nesting += loopDelta[i];
+        depth[i] = (size_t) nesting;
+    }
+
+    for (const VariableReference& ref : references) {
+        if (ref.wide) continue;
+
+        uint64_t weight = variables[ref.variable].hint;
+        for (size_t d = 0; d < depth[ref.line] && d < MAX_LOOP_DEPTH; d++) weight *= LOOP_WEIGHT;
+        variables[ref.variable].weight += weight;
+    }
+
+    // variables that must be in zero page first, then the most weight per byte
+    vector<size_t> order;
+    for (size_t v = 0; v < variables.size(); v++) order.push_back(v);
+    stable_sort(order.begin(), order.end(), [](size_t a, size_t b) {
+        const Variable& x = variables[a];
+        const Variable& y = variables[b];
+        if (x.needsZeroPage != y.needsZeroPage) return x.needsZeroPage;
+
+        // weights reach 58 bits on big programs, sizes 16, so the cross products need more than 64
+        return (unsigned __int128) x.weight * y.size > (unsigned __int128) y.weight * x.size;
+    });
+
+    for (size_t v : order) {
+        Variable& var = variables[v];
+        if (takeMemory(zeroPage, var.size, var.address)) {
+            var.placed = var.zeroPage = true;
+        } else if (var.needsZeroPage) {
+            reportDiagnostic(SeverityError, *var.file, var.line, 0, "No zero page left for " + var.name + ", it is used indirectly");
+            success = false;
+        } else if (takeMemory(ram, var.size, var.address)) {
+            var.placed = true;
+        } else {
+            reportDiagnostic(SeverityError, *var.file, var.line, 0, "No memory left for " + var.name);
+            success = false;
+        }
+    }
+
+    // rewrite the operands to hex addresses, so the usual addressing modes pick the encoding
+    for (const VariableReference& ref : references) {
+        const Variable& var = variables[ref.variable];
+        if (!var.placed) continue;
+
+        uint32_t value = var.address + ref.offset;
+        char address[8];
+        snprintf(address, sizeof(address), (value <= 0xff && !ref.wide) ? "$%02x" : "$%04x", value & 0xffff);
+
+        string text(program[ref.line].text());
+        text.replace(ref.start, ref.end - ref.start, address);
+        rewrittenLines.push_back(text);
+        program[ref.line].rewritten = &rewrittenLines.back();
+    }
+
+    // the declarations have done their job
+    size_t kept = 0;
+    for (size_t i = 0; i < program.size(); i++) {
+        if (!declaration[i]) program[kept++] = program[i];
+    }
+    program.resize(kept);
+
+    return success;
+}
+
+// see API note in variables.h
+void dumpVariables() {
+    for (const Variable& var : variables) {
+        if (!var.placed) continue;
+        cout << "variable: " << var.name << " - address: $" << setw(4) << setfill('0') << hex << var.address
+             << dec << " (" << (var.zeroPage ? "zero page" : "ram") << ", weight " << var.weight << ")" << endl;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef _6502_VARIABLES_H
+#define _6502_VARIABLES_H
+
+#include "source.h"
+
+#include <vector>
+
+/**
+ * allocateVariables(): give every variable declared with .var name, size[, weight] an address and
+ * rewrite the operands that name it to that address, before the first pass sees the program.
+ * Free memory is declared with .zp $xx-$xx and .ram $xxxx-$xxxx. Variables are ranked by their
+ * references, each weighted by the loop nesting it sits in (from backward branches and jmps) and by
+ * the optional weight hint, per byte of size. The best ranked go to zero page, so the operands that
+ * name them encode as zero page instructions, the rest go to .ram. Variables used through (name),y
+ * or (name,x) always go to zero page. The declarations are removed from the program.
+ * returns: false if a variable could not be placed. problems are reported as diagnostics
+ */
+bool allocateVariables(std::vector<SourceLine>& program);
+
+/**
+ * dumpVariables(): print where every variable went
+ */
+void dumpVariables();
+
+#endif
@@ -0,0 +1,13 @@
+; anonymous labels are counted by line, so a reference never picks up a closer label from another segment
+    .org $c030
++   rts
+    .org $c000
+-   inx
+    .org $c080
+-   iny
+    .org $c010
+    bne -          ; the iny at $c080, not the inx at $c000
+    beq +          ; the nop at $c090, not the rts at $c030
+    .org $c090
++   nop
+    bne -          ; the iny at $c080 again
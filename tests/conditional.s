@@ -0,0 +1,32 @@
+; .define values in every number syntax, tested with .if, .ifdef and -D from the command line
+    .define ONE 1
+    .define BORDER $d020
+    .define MASK %00001111
+    .define ZERO 0
+.if ONE
+    lda #$01
+.else
+    lda #$02
+.endif
+.if ZERO
+    brk
+.endif
+.if BORDER == $d020
+    sta $d020
+.endif
+.if MASK == 15
+    and #$0f
+.endif
+.if MASK != %1111
+    brk
+.endif
+.ifdef VERSION
+.if VERSION == 2
+    ldx #$02
+.else
+    ldx #$ff
+.endif
+.endif
+.ifndef MISSING
+    rts
+.endif
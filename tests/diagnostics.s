@@ -0,0 +1,8 @@
+; a redefined label, the same error on several lines and a labelled declaration
+start:
+    nop
+start:
+    jmp missing
+    jmp missing
+    jmp missing
+counter .var count, 1
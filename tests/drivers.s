@@ -0,0 +1,32 @@
+; labels, local and anonymous labels, data and segments, for comparing the drivers
+start:
+    ldx #$05
+@loop:
+    dex
+    bne @loop
+-   iny
+    bne -
+    beq +
+    nop
++   jmp ++
+    nop
++   nop
++   jsr other
+    rts
+other:
+@loop:
+    lda $0300,x
+    sta $d020
+    dex
+    bpl @loop
+    .local
+@loop:
+    bne @loop
+    jmp far
+table:
+    .db $01, $02, $03, $04
+    .org $c200
+far:
+    lda #$ff
+    sta $0400
+    rts
@@ -0,0 +1,5 @@
+; labels for the snapshot used by snapshot.s
+    .org $d020
+border:
+    .org $ffd2
+chrout:
@@ -0,0 +1,87 @@
+#!/bin/sh
+# regression tests: assemble the programs in tests/ and compare the bytes with the expected dumps.
+# run from the top directory after building, or through make test
+
+AS=./6502-as
+DIS=./6502-dis
+SFXRUN=tests/sfxrun
+TESTS=tests
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+failures=0
+
+fail() {
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+dump() {
+    od -An -tx1 -v "$1"
+}
+
+# assemble name.s with the given options and compare the output with name.hex
+check() {
+    name=$1
+    shift
+    if ! $AS "$@" -o "$OUT/$name.prg" "$TESTS/$name.s" > "$OUT/$name.log" 2>&1; then
+        fail "$name $*: assembly failed"
+        cat "$OUT/$name.log"
+        return
+    fi
+    dump "$OUT/$name.prg" | cmp -s - "$TESTS/$name.hex" || fail "$name $*: output differs from $name.hex"
+}
+
+# assemble name.s, which must fail, and compare the diagnostics with name.err
+check_diagnostics() {
+    name=$1
+    shift
+    if $AS "$@" -o "$OUT/$name.prg" "$TESTS/$name.s" > /dev/null 2> "$OUT/$name.log"; then
+        fail "$name $*: assembly should have failed"
+        return
+    fi
+    cmp -s "$OUT/$name.log" "$TESTS/$name.err" || fail "$name $*: diagnostics differ from $name.err"
+}
+
+# snapshot.s takes labels from a snapshot of kernal.s
+$AS --emit-symbols "$OUT/kernal.sym" -o "$OUT/kernal.prg" "$TESTS/kernal.s" > /dev/null 2>&1 || fail "could not write kernal.sym"
+
+# the serial, parallel and streaming drivers must produce the same bytes
+for jobs in "" "-j 1" "-j 4" "--stream"; do
+    check drivers $jobs
+    check segments $jobs
+    check anonymous $jobs
+    check snapshot $jobs --symbols "$OUT/kernal.sym"
+    check conditional $jobs -D VERSION=2
+    check_diagnostics diagnostics $jobs
+done
+
+# a self-extracting image must unpack to the plain one
+for jobs in "" "-j 4" "--stream"; do
+    if $AS $jobs --sfx '$0801' -o "$OUT/drivers.sfx" "$TESTS/drivers.s" > /dev/null 2>&1; then
+        $SFXRUN "$OUT/drivers.prg" "$OUT/drivers.sfx" || fail "drivers --sfx $jobs: does not unpack to drivers.prg"
+    else
+        fail "drivers --sfx $jobs: assembly failed"
+    fi
+done
+
+# variables are allocated before assembly starts, which streaming cannot wait for
+for jobs in "" "-j 4"; do
+    check variables $jobs
+done
+
+# the disassembler's listing must assemble back to the same image
+$DIS --verify "$OUT/drivers.prg" > /dev/null 2>&1 || fail "6502-dis --verify drivers.prg"
+if $DIS -o "$OUT/roundtrip.s" "$OUT/drivers.prg" > /dev/null 2>&1 &&
+   $AS -o "$OUT/roundtrip.prg" "$OUT/roundtrip.s" > /dev/null 2>&1; then
+    cmp -s "$OUT/roundtrip.prg" "$OUT/drivers.prg" || fail "disassembled drivers.prg assembles to different bytes"
+else
+    fail "could not disassemble and reassemble drivers.prg"
+fi
+
+if [ $failures -ne 0 ]; then
+    echo "$failures test(s) failed"
+    exit 1
+fi
+echo "all tests passed"
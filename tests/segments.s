@@ -0,0 +1,14 @@
+; segments out of address order: the second one loads below the first, the third leaves a gap
+    .org $c100
+entry:
+    jsr init
+    jmp main
+    .org $c000
+init:
+    lda #$00
+    sta $d020
+    rts
+    .org $c180
+main:
+    inc $d020
+    jmp main
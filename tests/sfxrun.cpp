@@ -0,0 +1,118 @@
+/**
+ * sfxrun: run a self-extracting PRG on a minimal 6502 until it jumps to the start of the plain PRG,
+ * then check that memory holds the plain image. Only the instructions the unpack stub uses are
+ * emulated. The plain program must start at its load address
+ *
+ * usage: sfxrun plain.prg sfx.prg
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+static const uint64_t MAX_STEPS = 100000000;
+
+static bool readFile(const char *path, std::vector<uint8_t>& bytes) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return bytes.size() >= 2;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<uint8_t> plain, sfx;
+    if (argc != 3 || !readFile(argv[1], plain) || !readFile(argv[2], sfx)) {
+        std::cerr << "usage: sfxrun plain.prg sfx.prg" << std::endl;
+        return 2;
+    }
+
+    std::vector<uint8_t> mem(0x10000, 0);
+    uint16_t load = sfx[0] | (sfx[1] << 8), entry = plain[0] | (plain[1] << 8);
+    for (size_t i = 2; i < sfx.size(); i++) mem[(load + i - 2) & 0xffff] = sfx[i];
+
+    uint16_t pc = load;
+    uint8_t a = 0, x = 0, y = 0, sp = 0xff;
+    bool n = false, z = false, c = false;
+
+    auto flags = [&](uint8_t v) { n = (v & 0x80) != 0; z = (v == 0); };
+    auto word = [&](uint16_t p) { return (uint16_t) (mem[p] | (mem[(p + 1) & 0xffff] << 8)); };
+    auto indirect = [&](uint8_t zp) { return (uint16_t) (word(zp) + y); };
+
+    uint64_t steps = 0;
+    while (pc != entry) {
+        if (++steps > MAX_STEPS) {
+            std::cerr << "sfxrun: stub did not reach $" << std::hex << entry << std::endl;
+            return 1;
+        }
+
+        uint8_t op = mem[pc], arg = mem[(pc + 1) & 0xffff];
+        switch (op) {
+        case 0xa9: a = arg; flags(a); pc += 2; break;                              // lda #
+        case 0xa0: y = arg; flags(y); pc += 2; break;                              // ldy #
+        case 0xa5: a = mem[arg]; flags(a); pc += 2; break;                         // lda zp
+        case 0x85: mem[arg] = a; pc += 2; break;                                   // sta zp
+        case 0xb1: a = mem[indirect(arg)]; flags(a); pc += 2; break;               // lda (zp),y
+        case 0x91: mem[indirect(arg)] = a; pc += 2; break;                         // sta (zp),y
+        case 0xe6: mem[arg]++; flags(mem[arg]); pc += 2; break;                    // inc zp
+        case 0x29: a &= arg; flags(a); pc += 2; break;                             // and #
+        case 0x69: {                                                               // adc #
+            unsigned r = a + arg + (c ? 1 : 0);
+            c = r > 0xff;
+            a = (uint8_t) r;
+            flags(a);
+            pc += 2;
+            break;
+        }
+        case 0xe5: {                                                               // sbc zp
+            int r = a - mem[arg] - (c ? 0 : 1);
+            c = r >= 0;
+            a = (uint8_t) r;
+            flags(a);
+            pc += 2;
+            break;
+        }
+        case 0xaa: x = a; flags(x); pc++; break;                                   // tax
+        case 0x8a: a = x; flags(a); pc++; break;                                   // txa
+        case 0xca: x--; flags(x); pc++; break;                                     // dex
+        case 0x38: c = true; pc++; break;                                          // sec
+        case 0x18: c = false; pc++; break;                                         // clc
+        case 0x4c: pc = word(pc + 1); break;                                       // jmp
+        case 0x20: {                                                               // jsr
+            uint16_t ret = pc + 2;
+            mem[0x100 + sp--] = ret >> 8;
+            mem[0x100 + sp--] = ret & 0xff;
+            pc = word(pc + 1);
+            break;
+        }
+        case 0x60: {                                                               // rts
+            uint8_t lo = mem[0x100 + ++sp];
+            uint8_t hi = mem[0x100 + ++sp];
+            pc = ((hi << 8) | lo) + 1;
+            break;
+        }
+        case 0xf0: case 0xd0: case 0x30: {                                         // beq, bne, bmi
+            bool taken = (op == 0xf0) ? z : (op == 0xd0) ? !z : n;
+            pc += 2;
+            if (taken) pc += (int8_t) arg;
+            break;
+        }
+        default:
+            std::cerr << "sfxrun: unexpected opcode $" << std::hex << (int) op << " at $" << pc << std::endl;
+            return 1;
+        }
+    }
+
+    for (size_t i = 2; i < plain.size(); i++) {
+        if (mem[(entry + i - 2) & 0xffff] != plain[i]) {
+            std::cerr << "sfxrun: unpacked image differs at $" << std::hex << ((entry + i - 2) & 0xffff) << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,8 @@
+; chrout comes from the snapshot of kernal.s, border is shadowed by a label defined further down
+    sta border
+    jsr chrout
+    jsr chrout
+    beq border
+    bne +
+border:
++   rts
@@ -0,0 +1,27 @@
+; variables ranked by loop weight per byte: the indirect pointer and the hinted byte get zero page first
+    .zp $fb-$fe
+    .ram $c800-$c8ff
+    .var rarely, 1
+    .var ptr, 2
+    .var counter, 1
+    .var table, 4
+    .var hinted, 1, 100
+    lda rarely
+    lda #$00
+    sta ptr
+    lda #$c0
+    sta ptr+1
+    ldy #$00
+outer:
+    ldx #$10
+inner:
+    lda (ptr),y
+    sta table,x
+    lda table,y
+    inc counter
+    dex
+    bne inner
+    iny
+    bne outer
+    lda hinted
+    rts